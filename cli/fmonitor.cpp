@@ -9,6 +9,14 @@
 #include <cerrno>
 #include <vector>
 #include <map>
+#include <mutex>
+#include "config.h"
+#if defined(HAVE_SYS_SIGNALFD_H)
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <thread>
+#endif
 #include "path_utils.h"
 #include "event.h"
 #include "monitor.h"
@@ -38,13 +46,18 @@ static const int OPT_ALLOW_OVERFLOW = 132;
 static const int OPT_MONITOR_PROPERTY = 133;
 static const int OPT_FIRE_IDLE_EVENTS = 134;
 static const int OPT_FILTER_FROM = 135;
+static const int OPT_IGNORE_FILE = 136;
+static const int OPT_IGNORE_FROM = 137;
 
 static Monitor *active_monitor = nullptr; // current active mnitor
+static std::mutex active_monitor_mutex;   // guards active_monitor deletion
 
 /* information get from command params */
 static std::vector<Monitor_filter> filters;
 static std::vector<EVENT_TYPE_FILTER> event_filters;
 static std::vector<std::string> filter_files;
+static std::vector<std::string> ignore_files;
+static std::string ignore_file_name;
 static bool _0flag = false;
 static bool _1flag = false;
 static bool aflag = false;
@@ -96,22 +109,18 @@ static void print_event_timestamp(const Event& evt) {
 }
 
 static void print_event_flags(const Event& evt) {
-	const std::vector<fm_event_flag>& flags = evt.get_flags();
-
 	if (nflag) {
-		int mask = 0;
-		for (const fm_event_flag& flag : flags) {
-	  		mask += static_cast<int> (flag);
-		}
+		std::cout << evt.get_mask();
+		return;
+	}
 
-		std::cout << mask;
-	} else {
-		for (size_t i = 0; i < flags.size(); ++i) {
-	 		std::cout << flags[i];
+	const std::vector<fm_event_flag> flags = evt.get_flags();
 
-	  		/* Event flag separator is currently hard-coded */
-	  		if (i != flags.size() - 1) std::cout << event_flag_separator;
-		}
+	for (size_t i = 0; i < flags.size(); ++i) {
+		std::cout << flags[i];
+
+		/* Event flag separator is currently hard-coded */
+		if (i != flags.size() - 1) std::cout << event_flag_separator;
 	}
 }
 
@@ -149,6 +158,10 @@ static void usage(ostream &stream) {
 	stream << "     --fire-idle-event " << "Fire idle events.\n";
 	stream << " -h, --help            " << "Show this message.\n";
 	stream << " -i, --include=REGEX   " << "Include paths matching REGEX.\n";
+	stream << "     --ignore-file=NAME\n";
+	stream << "                       " << "Apply the gitignore-style NAME files found while scanning.\n";
+	stream << "     --ignore-from=FILE\n";
+	stream << "                       " << "Apply the gitignore-style rules of FILE.\n";
 	stream << " -I, --insensitive     " << "Use case insensitive regular expressions.\n";
 	stream << " -l, --latency=DOUBLE  " << "Set the latency.\n";
 	stream << " -L, --follow-links    " << "Follow symbolic links.\n";
@@ -165,7 +178,7 @@ static void usage(ostream &stream) {
 	stream << "     --event=TYPE      " << "Filter the event by the specified type.\n";
 	stream << "     --event-flag-separator=STRING\n";
 	stream << "                       " << "Print event flags using the specified separator.\n";
-	stream << " -v, --verbose         " << "Print verbose output.\n";
+	stream << " -v, --verbose         " << "Print verbose output and the monitor statistics on exit.\n";
 	stream << "     --version         " << "Print the version of " << PACKAGE_NAME << " and exit.\n";
 	stream << "\n";
 
@@ -316,6 +329,8 @@ static void parse_opts(int argc, char **argv) {
 		{"format",               required_argument, nullptr,       OPT_FORMAT},
 		{"format-time",          required_argument, nullptr,       'f'},
 		{"help",                 no_argument,       nullptr,       'h'},
+		{"ignore-file",          required_argument, nullptr,       OPT_IGNORE_FILE},
+		{"ignore-from",          required_argument, nullptr,       OPT_IGNORE_FROM},
 		{"include",              required_argument, nullptr,       'i'},
 		{"insensitive",          no_argument,       nullptr,       'I'},
 		{"latency",              required_argument, nullptr,       'l'},
@@ -477,6 +492,14 @@ static void parse_opts(int argc, char **argv) {
 		      filter_files.emplace_back(optarg);
 		      break;
 
+		    case OPT_IGNORE_FILE:
+		      ignore_file_name = optarg;
+		      break;
+
+		    case OPT_IGNORE_FROM:
+		      ignore_files.emplace_back(optarg);
+		      break;
+
 		    case '?':
 		      usage(std::cerr);
 		      exit(FM_EXIT_UNK_OPT);
@@ -530,15 +553,64 @@ static void parse_opts(int argc, char **argv) {
 }
 
 static void close_monitor() {
+  std::lock_guard<std::mutex> guard(active_monitor_mutex);
   if (active_monitor) active_monitor->stop();
 }
 
+/*
+ * Monitor::stop() does not lock, therefore it can be invoked from a signal
+ * handler.  The handler is only used when signalfd is not available.
+ */
 static void close_handler(int signal) {
 	FM_ELOG("Executing termination handler.\n");
-	close_monitor();
+	if (active_monitor) active_monitor->stop();
+}
+
+#if defined(HAVE_SYS_SIGNALFD_H)
+static void signal_loop(int signal_fd) {
+	struct signalfd_siginfo info;
+
+	while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		FM_ELOG("Executing termination handler.\n");
+		close_monitor();
+	}
 }
 
+/*
+ * Termination signals are blocked in every thread and consumed from a signalfd
+ * by a dedicated thread, so that the monitor is stopped from a regular thread
+ * context.  This function must be called before any other thread is created.
+ */
+static bool register_signal_fd() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGABRT);
+	sigaddset(&signals, SIGINT);
+
+	if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) return false;
+
+	int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+	if (signal_fd == -1) {
+		pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+		return false;
+	}
+
+	std::thread(signal_loop, signal_fd).detach();
+	FM_ELOG("Signal descriptor registered.\n");
+
+	return true;
+}
+#endif
+
 static void register_signal_handlers() {
+#if defined(HAVE_SYS_SIGNALFD_H)
+	if (register_signal_fd()) return;
+
+	std::cerr << "Signal descriptor registration failed." << std::endl;
+#endif
+
 	struct sigaction action;
 	action.sa_handler = close_handler;
 	sigemptyset(&action.sa_mask);
@@ -611,6 +683,12 @@ void process_events(const std::vector<Event>& events, void *context)
 	}
 }
 
+static void print_statistics(ostream &stream) {
+	for (const auto &statistic : active_monitor->get_statistics()) {
+		stream << statistic.first << ": " << statistic.second << "\n";
+	}
+}
+
 static void start_monitor(int argc, char **argv, int optind) {
 	std::vector<std::string> paths;
 
@@ -660,10 +738,16 @@ static void start_monitor(int argc, char **argv, int optind) {
 	active_monitor->set_directory_only(dflag);
 	active_monitor->set_event_type_filters(event_filters);
 	active_monitor->set_filters(filters);
+	active_monitor->set_ignore_file_name(ignore_file_name);
+	for (const auto& ignore_file : ignore_files) {
+		active_monitor->add_ignore_file(ignore_file);
+	}
 	active_monitor->set_follow_symlinks(Lflag);
 	active_monitor->set_watch_access(aflag);
 
 	active_monitor->start();
+
+	if (vflag) print_statistics(std::cerr);
 }
 
 int main(int argc, char **argv) {
@@ -687,6 +771,7 @@ int main(int argc, char **argv) {
     	/* configure and start the monitor loop */
     	start_monitor(argc, argv, optind);
 
+    	std::lock_guard<std::mutex> guard(active_monitor_mutex);
     	delete active_monitor;
     	active_monitor = nullptr;
   	} catch (fm_exception& lex) {
@@ -1,3 +1,6 @@
 #cmakedefine HAVE_SYS_INOTIFY_H 1
+#cmakedefine HAVE_SYS_EVENTFD_H 1
+#cmakedefine HAVE_LINUX_IO_URING_H 1
+#cmakedefine HAVE_SYS_SIGNALFD_H 1
 #cmakedefine PACKAGE_NAME "fmonitor"
 #cmakedefine VERSION_STRING "1.0"
\ No newline at end of file
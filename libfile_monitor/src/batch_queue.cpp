@@ -0,0 +1,70 @@
+#include "batch_queue.h"
+
+namespace fm {
+    Batch_queue::Batch_queue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        cells.reset(new cell[size]);
+        mask = size - 1;
+
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool Batch_queue::try_push(Event_batch &batch) {
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        cell *target;
+
+        for (;;) {
+            target = &cells[position & mask];
+            size_t sequence = target->sequence.load(std::memory_order_acquire);
+            long long difference = static_cast<long long>(sequence) - static_cast<long long>(position);
+
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        target->batch.swap(batch);
+        target->sequence.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool Batch_queue::try_pop(Event_batch &batch) {
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+        cell *source;
+
+        for (;;) {
+            source = &cells[position & mask];
+            size_t sequence = source->sequence.load(std::memory_order_acquire);
+            long long difference = static_cast<long long>(sequence) - static_cast<long long>(position + 1);
+
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        source->batch.swap(batch);
+        source->sequence.store(position + mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    size_t Batch_queue::size() const {
+        size_t dequeued = dequeue_position.load(std::memory_order_relaxed);
+        size_t enqueued = enqueue_position.load(std::memory_order_relaxed);
+
+        return (enqueued > dequeued) ? enqueued - dequeued : 0;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * @brief Header of the fm::Batch_queue class.
+ *
+ * This header file defines the fm::Batch_queue class, a bounded lock-free
+ * queue of event batches.
+ * */
+
+#ifndef FILE_MONITOR_BATCH_QUEUE_H
+#define FILE_MONITOR_BATCH_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include "event_batch.h"
+
+namespace fm {
+    /*
+     * @brief Bounded multi-producer, multi-consumer queue of event batches.
+     *
+     * The queue is a ring of cells, each with a sequence number telling
+     * whether it is ready to be written or read at a given position (Dmitry
+     * Vyukov's bounded queue): pushing and popping claim a position with a
+     * compare-and-swap and never lock.
+     *
+     * Batches are exchanged with the cells rather than copied: a push leaves
+     * in the batch of the producer the memory of a batch popped earlier, so
+     * that the batches circulating between producers and consumers stop
+     * allocating once they have grown.  Consumers should clear the batch they
+     * pass to try_pop() to hand back empty storage.
+     * */
+    class Batch_queue {
+    public:
+        /*
+         * Creates a queue of at least @p capacity batches, rounded up to a
+         * power of two.
+         * */
+        explicit Batch_queue(size_t capacity);
+        Batch_queue(const Batch_queue &orig) = delete;
+        Batch_queue &operator=(const Batch_queue &that) = delete;
+
+        /*
+         * Moves @p batch to the back of the queue.  It returns false, leaving
+         * @p batch unchanged, if the queue is full.
+         * */
+        bool try_push(Event_batch &batch);
+
+        /*
+         * Moves the batch at the front of the queue to @p batch.  It returns
+         * false if the queue is empty.
+         * */
+        bool try_pop(Event_batch &batch);
+
+        size_t capacity() const { return mask + 1; }
+
+        /*
+         * Returns the number of queued batches, which may be outdated as soon
+         * as it is returned.
+         * */
+        size_t size() const;
+
+    private:
+        struct cell {
+            std::atomic<size_t> sequence;
+            Event_batch batch;
+        };
+
+        /* Positions are written by different threads: keep them apart. */
+        static const size_t CACHE_LINE_SIZE = 64;
+
+        std::unique_ptr<cell[]> cells;
+        size_t mask;
+        char padding0[CACHE_LINE_SIZE];
+        std::atomic<size_t> enqueue_position{0};
+        char padding1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_position{0};
+        char padding2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    };
+}
+
+#endif //FILE_MONITOR_BATCH_QUEUE_H
@@ -0,0 +1,362 @@
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <chrono>
+#include "crawler.h"
+#include <dirent.h>
+#include <unistd.h>
+#include "path_utils.h"
+#include "stat_batch.h"
+
+using std::string;
+using std::vector;
+
+namespace fm {
+    /*
+     * Descriptor of a listed directory, kept open until all its
+     * subdirectories have been opened relative to it.
+     */
+    struct directory_handle {
+        explicit directory_handle(int fd) : fd(fd) {}
+        ~directory_handle() { ::close(fd); }
+        directory_handle(const directory_handle &orig) = delete;
+        directory_handle &operator=(const directory_handle &that) = delete;
+
+        const int fd;
+    };
+
+    /*
+     * Identity of a directory reached by the crawler.
+     */
+    struct directory_key {
+        dev_t device;
+        ino_t inode;
+
+        bool operator==(const directory_key &other) const {
+            return device == other.device && inode == other.inode;
+        }
+    };
+
+    struct directory_key_hash {
+        size_t operator()(const directory_key &key) const {
+            return std::hash<unsigned long long>()(static_cast<unsigned long long>(key.inode) * 31 +
+                                                   static_cast<unsigned long long>(key.device));
+        }
+    };
+
+    struct Directory_crawler::crawl_task {
+        string path;
+        bool is_root;
+
+        /* Entries discovered in a directory listing are stat'ed relative to it. */
+        bool has_stat;
+        struct stat fd_stat;
+
+        /* The type of the entry was not reported by the listing. */
+        bool filter_after_stat;
+
+        /* Subdirectories are opened relative to their parent by the name at name_offset. */
+        std::shared_ptr<directory_handle> parent;
+        size_t name_offset;
+    };
+
+    /*
+     * Per-thread state, reused across tasks.
+     */
+    struct Directory_crawler::crawl_worker {
+        Directory_reader reader;
+        vector<crawl_task> discovered;
+        Stat_batch *stats;
+    };
+
+    struct Directory_crawler::crawl_queue {
+        std::mutex mutex;
+        std::deque<crawl_task> tasks;
+    };
+
+    struct Directory_crawler::crawl_state {
+        explicit crawl_state(unsigned int workers, const crawler_visitor &visitor) :
+            queues(workers), visitor(visitor)
+        {
+        }
+
+        vector<crawl_queue> queues;
+        const crawler_visitor &visitor;
+
+        /* Number of tasks queued or being processed. */
+        std::atomic<unsigned long long> pending{0};
+        std::atomic<unsigned long long> visited{0};
+        std::atomic<bool> aborted{false};
+
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        /* Directories visited so far, if directories are visited only once. */
+        std::mutex visited_mutex;
+        std::unordered_set<directory_key, directory_key_hash> visited_directories;
+    };
+
+    Directory_crawler::Directory_crawler(unsigned int thread_count,
+                                         bool follow_symlinks,
+                                         const std::atomic<bool> *cancel) :
+        thread_count(thread_count), follow_symlinks(follow_symlinks), cancel(cancel)
+    {
+        if (this->thread_count == 0) this->thread_count = std::thread::hardware_concurrency();
+        if (this->thread_count == 0) this->thread_count = 1;
+    }
+
+    unsigned int Directory_crawler::get_thread_count() const {
+        return thread_count;
+    }
+
+    void Directory_crawler::set_visit_files(bool visit_files) {
+        this->visit_files = visit_files;
+    }
+
+    void Directory_crawler::set_filter(const crawler_filter &filter) {
+        this->filter = filter;
+    }
+
+    void Directory_crawler::set_stat_queue_depth(unsigned int queue_depth) {
+        stat_queue_depth = queue_depth;
+    }
+
+    void Directory_crawler::set_stat_batches(const vector<Stat_batch *> &batches) {
+        stat_batches = batches;
+    }
+
+    void Directory_crawler::set_unique_directories(bool unique_directories) {
+        this->unique_directories = unique_directories;
+    }
+
+    void Directory_crawler::process(crawl_state &state,
+                                    unsigned int worker_index,
+                                    crawl_worker &worker,
+                                    crawl_task &task) {
+        if (!task.has_stat && !lstat_path(task.path, task.fd_stat)) return;
+
+        if (unique_directories && S_ISDIR(task.fd_stat.st_mode)) {
+            std::lock_guard<std::mutex> visited_guard(state.visited_mutex);
+            if (!state.visited_directories.insert({task.fd_stat.st_dev, task.fd_stat.st_ino}).second) return;
+        }
+
+        vector<crawl_task> &discovered = worker.discovered;
+        discovered.clear();
+
+        if (follow_symlinks && S_ISLNK(task.fd_stat.st_mode)) {
+            string link_path;
+            if (read_link_path(task.path, link_path)) {
+                discovered.push_back({link_path, task.is_root, false, {}, false, nullptr, 0});
+            }
+        }
+
+        ++state.visited;
+
+        if (state.visitor(task.path, task.fd_stat, task.is_root) &&
+            S_ISDIR(task.fd_stat.st_mode) &&
+            (task.parent ? worker.reader.open_at(task.parent->fd, task.path.c_str() + task.name_offset)
+                         : worker.reader.open(task.path))) {
+            /* The parent is closed once all its subdirectories have been opened. */
+            task.parent.reset();
+
+            DIRECTORY_ENTRY entry;
+            const size_t first_entry = discovered.size();
+
+            while (worker.reader.next(entry)) {
+                /*
+                 * When only directories are visited, entries whose type is
+                 * reported by the file system are skipped without stat().
+                 */
+                if (!visit_files &&
+                    entry.type != DT_UNKNOWN &&
+                    entry.type != DT_DIR &&
+                    !(follow_symlinks && entry.type == DT_LNK)) {
+                    continue;
+                }
+
+                crawl_task child;
+                child.is_root = false;
+                child.path.reserve(task.path.size() + 1 + entry.name_length);
+                child.path.append(task.path).append(1, '/').append(entry.name, entry.name_length);
+
+                /* Filtered entries are not even stat'ed if their type is known. */
+                child.filter_after_stat = (entry.type == DT_UNKNOWN);
+
+                if (filter && !child.filter_after_stat && !(follow_symlinks && entry.type == DT_LNK) &&
+                    !filter(child.path, entry.type == DT_DIR)) {
+                    continue;
+                }
+
+                discovered.push_back(std::move(child));
+            }
+
+            /*
+             * The entries are stat'ed once the listing is complete: their
+             * names are then stable in their paths.
+             */
+            Stat_batch &stats = *worker.stats;
+            const size_t name_offset = task.path.size() + 1;
+            stats.clear();
+
+            for (size_t i = first_entry; i < discovered.size(); ++i) {
+                stats.add(worker.reader.get_fd(), discovered[i].path.c_str() + name_offset);
+            }
+
+            stats.run();
+
+            size_t kept = first_entry;
+
+            for (size_t i = first_entry; i < discovered.size(); ++i) {
+                crawl_task &child = discovered[i];
+
+                /* The entry has been removed in the meantime. */
+                if (!stats.get_result(i - first_entry, child.fd_stat)) continue;
+                child.has_stat = true;
+
+                if (!visit_files && !S_ISDIR(child.fd_stat.st_mode) &&
+                    !(follow_symlinks && S_ISLNK(child.fd_stat.st_mode))) {
+                    continue;
+                }
+
+                if (filter && child.filter_after_stat && !(follow_symlinks && S_ISLNK(child.fd_stat.st_mode)) &&
+                    !filter(child.path, S_ISDIR(child.fd_stat.st_mode))) {
+                    continue;
+                }
+
+                if (kept != i) discovered[kept] = std::move(child);
+                ++kept;
+            }
+
+            discovered.resize(kept);
+
+            /* The descriptor is handed over to the subdirectories, if any. */
+            std::shared_ptr<directory_handle> handle;
+
+            for (size_t i = first_entry; i < discovered.size(); ++i) {
+                crawl_task &child = discovered[i];
+                if (!S_ISDIR(child.fd_stat.st_mode)) continue;
+
+                if (!handle) handle = std::make_shared<directory_handle>(worker.reader.release());
+                child.parent = handle;
+                child.name_offset = name_offset;
+            }
+
+            if (!handle) worker.reader.close();
+        }
+
+        if (discovered.empty()) return;
+
+        /*
+         * Tasks are popped from the back of the queue: push them in reverse
+         * order so that they are visited in directory order.
+         */
+        state.pending += discovered.size();
+
+        crawl_queue &queue = state.queues[worker_index];
+        std::lock_guard<std::mutex> queue_guard(queue.mutex);
+
+        for (auto i = discovered.rbegin(); i != discovered.rend(); ++i) {
+            queue.tasks.push_back(std::move(*i));
+        }
+    }
+
+    void Directory_crawler::work(crawl_state &state, unsigned int worker) {
+        const unsigned int workers = static_cast<unsigned int>(state.queues.size());
+        unsigned int idle_rounds = 0;
+        crawl_worker worker_state;
+        std::unique_ptr<Stat_batch> own_stats;
+
+        if (worker < stat_batches.size()) {
+            worker_state.stats = stat_batches[worker];
+        } else {
+            own_stats = Stat_batch::create(stat_queue_depth);
+            worker_state.stats = own_stats.get();
+        }
+
+        while (state.pending.load() && !state.aborted.load()) {
+            if (cancel && cancel->load()) {
+                state.aborted = true;
+                break;
+            }
+
+            crawl_task task;
+            bool found = false;
+
+            /* Pop from the back of the own queue, steal from the front of the others. */
+            for (unsigned int i = 0; i < workers && !found; ++i) {
+                crawl_queue &queue = state.queues[(worker + i) % workers];
+                std::lock_guard<std::mutex> queue_guard(queue.mutex);
+
+                if (queue.tasks.empty()) continue;
+
+                if (i == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                found = true;
+            }
+
+            if (!found) {
+                /* Other threads are still processing tasks that may produce work. */
+                if (++idle_rounds < 64) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                continue;
+            }
+
+            idle_rounds = 0;
+
+            try {
+                process(state, worker, worker_state, task);
+            } catch (...) {
+                std::lock_guard<std::mutex> error_guard(state.error_mutex);
+                if (!state.error) state.error = std::current_exception();
+                state.aborted = true;
+            }
+
+            --state.pending;
+        }
+    }
+
+    unsigned long long Directory_crawler::crawl(const string &root, const crawler_visitor &visitor) {
+        return crawl(vector<string>{root}, visitor);
+    }
+
+    unsigned long long Directory_crawler::crawl(const vector<string> &roots, const crawler_visitor &visitor) {
+        crawl_state state(thread_count, visitor);
+
+        state.pending = roots.size();
+
+        /* Queues are popped from the back: the first root is pushed last. */
+        for (size_t i = roots.size(); i > 0; --i) {
+            state.queues[(i - 1) % thread_count].tasks.push_back({roots[i - 1], true, false, {}, false, nullptr, 0});
+        }
+
+        if (thread_count == 1) {
+            work(state, 0);
+        } else {
+            vector<std::thread> threads;
+
+            for (unsigned int i = 1; i < thread_count; ++i) {
+                threads.emplace_back(&Directory_crawler::work, this, std::ref(state), i);
+            }
+
+            work(state, 0);
+
+            for (std::thread &thread : threads) thread.join();
+        }
+
+        if (state.error) std::rethrow_exception(state.error);
+
+        return state.visited.load();
+    }
+}
@@ -0,0 +1,155 @@
+/*
+ * @brief Header of the fm::Directory_crawler class.
+ *
+ * This header file defines the fm::Directory_crawler class, the directory
+ * walker used by the monitors to scan the observed paths.
+ * */
+
+#ifndef FILE_MONITOR_CRAWLER_H
+#define FILE_MONITOR_CRAWLER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <sys/stat.h>
+
+namespace fm {
+    class Stat_batch;
+
+    /*
+     * @brief Function definition of a crawler visitor.
+     *
+     * The visitor is invoked once for each node reached by the crawler with
+     * the node path, its lstat() information and whether it is the root of
+     * the crawl (or the target of a followed root symbolic link).  It returns
+     * true if the children of the node, when it is a directory, should be
+     * crawled as well.
+     *
+     * When the crawler runs more than one thread, the visitor is invoked
+     * concurrently and must synchronize access to shared state.
+     * */
+    typedef std::function<bool(const std::string &path,
+                               const struct stat &fd_stat,
+                               bool is_root)> crawler_visitor;
+
+    /*
+     * @brief Function definition of a crawler entry filter.
+     *
+     * The filter is invoked for each directory entry before it is stat'ed,
+     * with its path and whether it is a directory.  Entries for which it
+     * returns false are neither stat'ed nor visited.  Like the visitor, it is
+     * invoked concurrently when the crawler runs more than one thread.
+     * */
+    typedef std::function<bool(const std::string &path, bool is_dir)> crawler_filter;
+
+    /*
+     * @brief Multi-threaded, work-stealing directory crawler.
+     *
+     * Each crawler thread owns a queue of directories: it pushes the children
+     * it discovers to its own queue and pops them in depth-first order, and
+     * steals from the opposite end of the queues of the other threads when its
+     * own queue is empty.
+     *
+     * With a single thread the crawl runs on the calling thread and visits
+     * the nodes in the same depth-first order as a recursive scan.
+     *
+     * Directories are listed with a Directory_reader and their entries are
+     * stat'ed relative to the directory descriptor, so that each node costs a
+     * single stat() call and no full path resolution.  Subdirectories are
+     * opened relative to the descriptor of their parent, which stays open
+     * until all of them have been opened.
+     * */
+    class Directory_crawler {
+    public:
+        /*
+         * @param thread_count The number of crawler threads, 0 to use one thread
+         *        per hardware thread.
+         * @param follow_symlinks Whether symbolic links are resolved and their
+         *        target crawled.  The link itself is visited anyway.
+         * @param cancel An optional flag that aborts the crawl when set.
+         * */
+        Directory_crawler(unsigned int thread_count,
+                          bool follow_symlinks,
+                          const std::atomic<bool> *cancel = nullptr);
+
+        /*
+         * Crawls @p root, invoking @p visitor for each node.  It returns the
+         * number of visited nodes.  An exception thrown by the visitor aborts
+         * the crawl and is rethrown by this function.
+         * */
+        unsigned long long crawl(const std::string &root, const crawler_visitor &visitor);
+
+        /*
+         * Crawls each of @p roots, which are spread across the queues of the
+         * crawler threads so that they are crawled concurrently.  With a
+         * single thread they are crawled in order.
+         * */
+        unsigned long long crawl(const std::vector<std::string> &roots, const crawler_visitor &visitor);
+
+        unsigned int get_thread_count() const;
+
+        /*
+         * If @p visit_files is false, only directories (and, when following
+         * them, symbolic links) below the root are visited.  Entries whose type
+         * is reported by the directory listing are then filtered without
+         * calling stat().  The default is true.
+         * */
+        void set_visit_files(bool visit_files);
+
+        /*
+         * Sets the filter applied to the entries below the root.  Entries whose
+         * type is not reported by the directory listing are filtered after the
+         * stat() call, and symbolic links are not filtered when they are
+         * followed.
+         * */
+        void set_filter(const crawler_filter &filter);
+
+        /*
+         * Sets the number of stat() requests each crawler thread submits at a
+         * time through io_uring, 0 to call stat() synchronously, the default.
+         * The entries of a directory are listed and then stat'ed as a single
+         * batch.  Synchronous calls are used if io_uring is not available.
+         * */
+        void set_stat_queue_depth(unsigned int queue_depth);
+
+        /*
+         * Sets the batches the crawler threads stat entries with: the thread
+         * @c i uses @p batches[i], which must outlive the crawls, instead of
+         * creating a batch at each crawl.  Threads without a batch create one
+         * as set by set_stat_queue_depth().
+         * */
+        void set_stat_batches(const std::vector<Stat_batch *> &batches);
+
+        /*
+         * If @p unique_directories is true, a directory reached more than once
+         * during a crawl, through symbolic links or bind mounts, is only
+         * visited the first time, which also breaks symbolic link cycles.  The
+         * default is false.
+         * */
+        void set_unique_directories(bool unique_directories);
+
+    private:
+        struct crawl_task;
+        struct crawl_queue;
+        struct crawl_state;
+        struct crawl_worker;
+
+        void process(crawl_state &state,
+                     unsigned int worker_index,
+                     crawl_worker &worker,
+                     crawl_task &task);
+        void work(crawl_state &state, unsigned int worker);
+
+        unsigned int thread_count;
+        bool follow_symlinks;
+        bool visit_files = true;
+        crawler_filter filter;
+        unsigned int stat_queue_depth = 0;
+        std::vector<Stat_batch *> stat_batches;
+        bool unique_directories = false;
+        const std::atomic<bool> *cancel;
+    };
+}
+
+#endif //FILE_MONITOR_CRAWLER_H
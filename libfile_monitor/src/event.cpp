@@ -22,25 +22,34 @@ namespace fm {
 		Overflow
 	};
 
-    Event::Event(std::string path, time_t event_time, std::vector <fm_event_flag> flags) :
-        path(std::move(path)), event_time(event_time), flags(std::move(flags))
+    Event::Event(std::string path, time_t event_time, fm_event_mask flags) :
+        path(std::move(path)), event_time_ns(event_time * NANOSECONDS_PER_SECOND), flags(flags)
     {
     }
 
-    Event::~Event() {
-
+    Event::Event(std::string path, const struct timespec &event_time, fm_event_mask flags) :
+        path(std::move(path)),
+        event_time_ns(event_time.tv_sec * NANOSECONDS_PER_SECOND + event_time.tv_nsec),
+        flags(flags)
+    {
     }
 
-    std::string Event::get_path() const {
-        return path;
+    Event::Event(std::string path, time_t event_time, const std::vector<fm_event_flag> &flags) :
+        Event(std::move(path), event_time, NoOp)
+    {
+        for (const fm_event_flag &flag : flags) this->flags |= flag;
     }
 
     std::vector<fm_event_flag> Event::get_flags() const {
-        return flags;
-    }
+        if (flags == NoOp) return {NoOp};
+
+        std::vector<fm_event_flag> event_flags;
+
+        for (const fm_event_flag &flag : g_all_event_flags) {
+            if (flags & flag) event_flags.push_back(flag);
+        }
 
-    time_t Event::get_time() const {
-        return event_time;
+        return event_flags;
     }
 
     fm_event_flag Event::get_event_flag_by_name(const std::string &name) {
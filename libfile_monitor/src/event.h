@@ -31,13 +31,34 @@ namespace fm {
 
 	extern std::vector<fm_event_flag> g_all_event_flags;
 
+    /*
+     * Set of event flags, stored as the bitwise OR of fm_event_flag values.
+     * An empty mask stands for NoOp.
+     */
+    typedef unsigned int fm_event_mask;
+
+    /*
+     * A change event: the path of the object, the time of the event with
+     * nanosecond resolution, and its flags as a bit mask.  Accessors do not
+     * copy: get_flags() is kept for compatibility and builds a vector.
+     */
     class Event {
     public:
-        Event(std::string path, time_t event_time, std::vector<fm_event_flag> flags);
-        virtual ~Event();
+        Event(std::string path, time_t event_time, fm_event_mask flags);
+        Event(std::string path, const struct timespec &event_time, fm_event_mask flags);
+        Event(std::string path, time_t event_time, const std::vector<fm_event_flag> &flags);
+
+        const std::string &get_path() const { return path; }
+        time_t get_time() const { return static_cast<time_t>(event_time_ns / NANOSECONDS_PER_SECOND); }
+        long long get_time_ns() const { return event_time_ns; }
+        fm_event_mask get_mask() const { return flags; }
+        bool has_flag(fm_event_flag flag) const { return (flags & flag) != 0; }
+        void set_mask(fm_event_mask mask) { flags = mask; }
 
-        std::string get_path() const;
-        time_t get_time() const;
+        /*
+         * Returns the flags of the event in the order of g_all_event_flags, or
+         * NoOp if the event has none.
+         * */
         std::vector<fm_event_flag> get_flags() const;
 
         /*
@@ -59,9 +80,11 @@ namespace fm {
         static std::string get_event_flag_name(const fm_event_flag &flag);
 
     private:
+        static const long long NANOSECONDS_PER_SECOND = 1000000000LL;
+
         std::string path;
-        time_t event_time;
-        std::vector<fm_event_flag> flags;
+        long long event_time_ns;
+        fm_event_mask flags;
     };
 
     /*
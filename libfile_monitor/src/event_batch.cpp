@@ -0,0 +1,64 @@
+#include <cstring>
+#include <algorithm>
+#include "event_batch.h"
+
+namespace fm {
+    static const long long NANOSECONDS_PER_SECOND = 1000000000LL;
+
+    void Event_batch::add(const char *path, size_t length, long long time_ns, fm_event_mask flags) {
+        size_t offset = arena.size();
+
+        arena.resize(offset + length + 1);
+        memcpy(&arena[offset], path, length);
+        arena[offset + length] = '\0';
+
+        records.push_back({offset, length, time_ns, flags});
+    }
+
+    void Event_batch::add(const std::string &path, long long time_ns, fm_event_mask flags) {
+        add(path.data(), path.size(), time_ns, flags);
+    }
+
+    void Event_batch::add(const std::string &path, const struct timespec &time, fm_event_mask flags) {
+        add(path, time.tv_sec * NANOSECONDS_PER_SECOND + time.tv_nsec, flags);
+    }
+
+    void Event_batch::add(const Event &event) {
+        add(event.get_path(), event.get_time_ns(), event.get_mask());
+    }
+
+    void Event_batch::clear() {
+        arena.clear();
+        records.clear();
+    }
+
+    void Event_batch::swap(Event_batch &other) {
+        arena.swap(other.arena);
+        records.swap(other.records);
+    }
+
+    void Event_batch::sort_by_path() {
+        const char *paths = arena.data();
+
+        /* Paths are NUL-terminated and contain no NUL. */
+        std::stable_sort(records.begin(), records.end(), [paths] (const event_record &a, const event_record &b) {
+            return strcmp(paths + a.path_offset, paths + b.path_offset) < 0;
+        });
+    }
+
+    void Event_batch::to_events(std::vector<Event> &events) const {
+        events.reserve(events.size() + records.size());
+
+        for (size_t i = 0; i < records.size(); ++i) {
+            struct timespec time;
+            time.tv_sec = static_cast<time_t>(records[i].time_ns / NANOSECONDS_PER_SECOND);
+            time.tv_nsec = static_cast<long>(records[i].time_ns % NANOSECONDS_PER_SECOND);
+
+            events.emplace_back(std::string(get_path(i), get_path_length(i)), time, records[i].flags);
+        }
+    }
+
+    size_t Event_batch::memory_usage() const {
+        return arena.capacity() + records.capacity() * sizeof(event_record);
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * @brief Header of the fm::Event_batch class.
+ *
+ * This header file defines the fm::Event_batch class, the set of events
+ * collected by a monitor during an iteration of its loop.
+ * */
+
+#ifndef FILE_MONITOR_EVENT_BATCH_H
+#define FILE_MONITOR_EVENT_BATCH_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <ctime>
+#include "event.h"
+
+namespace fm {
+    /*
+     * @brief Batch of events whose paths are stored in an arena.
+     *
+     * The paths of the events are appended, NUL-terminated, to a single
+     * character buffer and each event is a fixed-size record referencing its
+     * path by offset.  clear() keeps the capacity of both buffers, so that a
+     * batch reused across iterations stops allocating once it has grown to the
+     * size of the largest batch.
+     *
+     * Events are filtered in place with remove_if(): records are compacted,
+     * while the arena is left untouched until the batch is cleared.
+     * */
+    class Event_batch {
+    public:
+        Event_batch() = default;
+        Event_batch(const Event_batch &orig) = delete;
+        Event_batch &operator=(const Event_batch &that) = delete;
+
+        /*
+         * Appends an event on @p path.
+         * */
+        void add(const char *path, size_t length, long long time_ns, fm_event_mask flags);
+        void add(const std::string &path, long long time_ns, fm_event_mask flags);
+        void add(const std::string &path, const struct timespec &time, fm_event_mask flags);
+
+        /*
+         * Appends a copy of @p event.
+         * */
+        void add(const Event &event);
+
+        size_t size() const { return records.size(); }
+        bool empty() const { return records.empty(); }
+
+        /*
+         * Removes all events.  The memory of the batch is kept for reuse.
+         * */
+        void clear();
+
+        /*
+         * Exchanges the events, and the memory, of two batches.
+         * */
+        void swap(Event_batch &other);
+
+        /*
+         * Accessors of the event at @p index.  The path is NUL-terminated and
+         * remains valid until the batch is cleared or an event is added.
+         * */
+        const char *get_path(size_t index) const { return &arena[records[index].path_offset]; }
+        size_t get_path_length(size_t index) const { return records[index].path_length; }
+        long long get_time_ns(size_t index) const { return records[index].time_ns; }
+        time_t get_time(size_t index) const { return static_cast<time_t>(records[index].time_ns / 1000000000LL); }
+        fm_event_mask get_mask(size_t index) const { return records[index].flags; }
+        void set_mask(size_t index, fm_event_mask flags) { records[index].flags = flags; }
+
+        /*
+         * Removes the events for which @p predicate(batch, index) returns true,
+         * preserving the order of the others.  The predicate may update the
+         * event it is passed.
+         * */
+        template<typename Predicate>
+        void remove_if(Predicate predicate);
+
+        /*
+         * Sorts the events by path, preserving the order of the events of a
+         * path.
+         * */
+        void sort_by_path();
+
+        /*
+         * Appends the events of the batch to @p events as fm::Event objects.
+         * */
+        void to_events(std::vector<Event> &events) const;
+
+        /*
+         * Returns the number of bytes allocated by the batch.
+         * */
+        size_t memory_usage() const;
+
+    private:
+        struct event_record {
+            size_t path_offset;
+            size_t path_length;
+            long long time_ns;
+            fm_event_mask flags;
+        };
+
+        std::vector<char> arena;
+        std::vector<event_record> records;
+    };
+
+    template<typename Predicate>
+    void Event_batch::remove_if(Predicate predicate) {
+        size_t kept = 0;
+
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (predicate(*this, i)) continue;
+            if (kept != i) records[kept] = records[i];
+            ++kept;
+        }
+
+        records.resize(kept);
+    }
+}
+
+#endif //FILE_MONITOR_EVENT_BATCH_H
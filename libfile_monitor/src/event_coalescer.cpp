@@ -0,0 +1,141 @@
+#include <algorithm>
+#include "event_coalescer.h"
+
+using namespace std::chrono;
+
+namespace fm {
+    void Event_coalescer::set_window(milliseconds window, milliseconds max_delay) {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+
+        this->window = std::max(window, milliseconds(0));
+        this->max_delay = std::max(max_delay, this->window);
+        enabled = (this->window.count() > 0);
+    }
+
+    void Event_coalescer::add(Event_batch &batch) {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+
+        const time_point now = steady_clock::now();
+        const bool was_empty = pending.empty();
+
+        batch.remove_if([&] (Event_batch &events, size_t i) {
+            fm_event_mask flags = events.get_mask(i);
+
+            if (flags == NoOp || (flags & Overflow)) return false;
+
+            ++raw_events;
+            key.assign(events.get_path(i), events.get_path_length(i));
+
+            auto found = pending_index.find(key);
+
+            if (found == pending_index.end()) {
+                pending_index.emplace(key, pending.size());
+                const bool created = (flags & Created) && !(flags & Removed);
+                pending.push_back({key, events.get_time_ns(i), flags, created, now, now});
+                return true;
+            }
+
+            pending_event &event = pending[found->second];
+            ++merged_events;
+
+            /* An object created and removed within the window never existed. */
+            if (event.cancellable && (flags & Removed)) {
+                event.flags = NoOp;
+                pending_index.erase(found);
+                ++cancelled_events;
+                return true;
+            }
+
+            event.flags |= flags;
+            event.time_ns = events.get_time_ns(i);
+            event.last_seen = now;
+            return true;
+        });
+
+        if (was_empty && !pending.empty()) coalescer_cv.notify_all();
+    }
+
+    Event_coalescer::time_point Event_coalescer::get_deadline(const pending_event &event) const {
+        return std::min(event.last_seen + window, event.first_seen + max_delay);
+    }
+
+    void Event_coalescer::take_due_events(Event_batch &batch, time_point now, bool all) {
+        size_t kept = 0;
+
+        for (size_t i = 0; i < pending.size(); ++i) {
+            pending_event &event = pending[i];
+
+            if (event.flags == NoOp) continue;
+
+            if (all || get_deadline(event) <= now) {
+                batch.add(event.path, event.time_ns, event.flags);
+                pending_index.erase(event.path);
+                continue;
+            }
+
+            if (kept != i) {
+                pending[kept] = std::move(event);
+                pending_index[pending[kept].path] = kept;
+            }
+
+            ++kept;
+        }
+
+        pending.resize(kept);
+    }
+
+    bool Event_coalescer::wait_for_due_events(Event_batch &batch, const std::atomic<bool> &stop) {
+        std::unique_lock<std::mutex> coalescer_lock(coalescer_mutex);
+
+        for (;;) {
+            if (stop) return false;
+
+            const time_point now = steady_clock::now();
+            const size_t previous_size = batch.size();
+
+            take_due_events(batch, now, false);
+
+            if (batch.size() > previous_size) return true;
+
+            if (pending.empty()) {
+                coalescer_cv.wait(coalescer_lock);
+                continue;
+            }
+
+            time_point deadline = time_point::max();
+            for (const pending_event &event : pending) deadline = std::min(deadline, get_deadline(event));
+
+            coalescer_cv.wait_until(coalescer_lock, deadline);
+        }
+    }
+
+    void Event_coalescer::flush(Event_batch &batch) {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+        take_due_events(batch, steady_clock::now(), true);
+    }
+
+    void Event_coalescer::wake() {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+        coalescer_cv.notify_all();
+    }
+
+    size_t Event_coalescer::size() const {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+        return pending_index.size();
+    }
+
+    unsigned long long Event_coalescer::get_raw_events() const {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+        return raw_events;
+    }
+
+    unsigned long long Event_coalescer::get_merged_events() const {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+        return merged_events;
+    }
+
+    unsigned long long Event_coalescer::get_cancelled_events() const {
+        std::lock_guard<std::mutex> coalescer_guard(coalescer_mutex);
+        return cancelled_events;
+    }
+}
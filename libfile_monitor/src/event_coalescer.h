@@ -0,0 +1,109 @@
+/*
+ * @brief Header of the fm::Event_coalescer class.
+ *
+ * This header file defines the fm::Event_coalescer class, which merges the
+ * events of a path received within a quiet window.
+ * */
+
+#ifndef FILE_MONITOR_EVENT_COALESCER_H
+#define FILE_MONITOR_EVENT_COALESCER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "event_batch.h"
+
+namespace fm {
+    /*
+     * @brief Per-path event coalescing stage.
+     *
+     * Events added to the coalescer are held back, one pending event per path,
+     * until no event has been received on their path for the quiet window:
+     *
+     *   - The flags of the events of a path are OR-ed and the pending event
+     *     takes the time of the last one.
+     *
+     *   - An object created and removed within the window is not reported at
+     *     all, provided its first pending event was its creation: an object
+     *     that existed before the window and is removed is always reported.
+     *
+     *   - A pending event is released after the maximum delay even if its path
+     *     never becomes quiet, so that a file written continuously is still
+     *     reported.
+     *
+     * Idle and overflow events are not coalesced.  Released events are
+     * returned in the order their path was first seen.  The coalescer is
+     * thread-safe: a monitor adds events from its thread and delivers them
+     * from a thread waiting in wait_for_due_events().
+     * */
+    class Event_coalescer {
+    public:
+        /*
+         * Sets the quiet window, 0 to disable coalescing, and the maximum
+         * delay of an event.
+         * */
+        void set_window(std::chrono::milliseconds window, std::chrono::milliseconds max_delay);
+        bool is_enabled() const { return enabled; }
+
+        /*
+         * Moves the events of @p batch to the pending events.  The events that
+         * are not coalesced are left in @p batch.
+         * */
+        void add(Event_batch &batch);
+
+        /*
+         * Waits until some pending events are due and appends them to @p batch.
+         * It returns false, without waiting, once @p stop is set.
+         * */
+        bool wait_for_due_events(Event_batch &batch, const std::atomic<bool> &stop);
+
+        /*
+         * Appends all the pending events to @p batch.
+         * */
+        void flush(Event_batch &batch);
+
+        /*
+         * Wakes up the threads waiting in wait_for_due_events().  It takes the
+         * coalescer lock, hence it must not be called from a signal handler.
+         * */
+        void wake();
+
+        size_t size() const;
+        unsigned long long get_raw_events() const;
+        unsigned long long get_merged_events() const;
+        unsigned long long get_cancelled_events() const;
+
+    private:
+        typedef std::chrono::steady_clock::time_point time_point;
+
+        struct pending_event {
+            std::string path;
+            long long time_ns;
+            fm_event_mask flags;        // NoOp if cancelled
+            bool cancellable;           // began with a creation, not removed since
+            time_point first_seen;
+            time_point last_seen;
+        };
+
+        void take_due_events(Event_batch &batch, time_point now, bool all);
+        time_point get_deadline(const pending_event &event) const;
+
+        mutable std::mutex coalescer_mutex;
+        std::condition_variable coalescer_cv;
+        std::atomic<bool> enabled{false};
+        std::chrono::milliseconds window{0};
+        std::chrono::milliseconds max_delay{0};
+        std::vector<pending_event> pending;                 // in the order paths were first seen
+        std::unordered_map<std::string, size_t> pending_index;
+        std::string key;
+        unsigned long long raw_events = 0;
+        unsigned long long merged_events = 0;
+        unsigned long long cancelled_events = 0;
+    };
+}
+
+#endif //FILE_MONITOR_EVENT_COALESCER_H
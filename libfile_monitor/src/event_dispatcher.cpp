@@ -0,0 +1,264 @@
+#include <algorithm>
+#include "event_dispatcher.h"
+#include "string_utils.h"
+
+namespace fm {
+    Event_dispatcher::~Event_dispatcher() {
+        stop();
+    }
+
+    bool Event_dispatcher::parse_policy(const std::string &name, fm_backpressure_policy &policy) {
+        if (name == "block") policy = backpressure_block;
+        else if (name == "drop-oldest") policy = backpressure_drop_oldest;
+        else if (name == "coalesce") policy = backpressure_coalesce;
+        else return false;
+
+        return true;
+    }
+
+    void Event_dispatcher::start(size_t queue_size,
+                                 fm_backpressure_policy policy,
+                                 unsigned int worker_count,
+                                 dispatch_function function,
+                                 partition_function partition,
+                                 failure_function on_failure) {
+        if (running) return;
+
+        this->policy = policy;
+        this->function = std::move(function);
+        this->partition = std::move(partition);
+        this->on_failure = std::move(on_failure);
+        failed = false;
+        error = nullptr;
+        stopping = false;
+        enabled = true;
+        running = true;
+
+        workers.clear();
+
+        for (unsigned int i = 0; i < std::max(worker_count, 1u); ++i) {
+            workers.emplace_back(new worker);
+            workers.back()->queue.reset(new Batch_queue(queue_size));
+        }
+
+        for (auto &target : workers) {
+            target->thread = std::thread(&Event_dispatcher::dispatch_loop, this, std::ref(*target));
+        }
+    }
+
+    void Event_dispatcher::stop() {
+        if (!running) return;
+
+        stopping = true;
+
+        {
+            std::lock_guard<std::mutex> sleep_guard(sleep_mutex);
+            for (auto &target : workers) target->batch_available.notify_all();
+        }
+
+        for (auto &target : workers) target->thread.join();
+
+        workers.clear();
+        running = false;
+    }
+
+    void Event_dispatcher::rethrow_error() {
+        std::exception_ptr pending;
+
+        {
+            std::lock_guard<std::mutex> error_guard(error_mutex);
+            std::swap(pending, error);
+        }
+
+        if (pending) std::rethrow_exception(pending);
+    }
+
+    void Event_dispatcher::push(Event_batch &batch) {
+        if (batch.empty()) return;
+
+        if (failed) {
+            ++dropped_batches;
+            dropped_events += batch.size();
+            batch.clear();
+            return;
+        }
+
+        if (workers.size() == 1) {
+            push_to(*workers[0], batch);
+            return;
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const char *path = batch.get_path(i);
+            size_t length = batch.get_path_length(i);
+            size_t key_length = partition ? std::min(partition(path, length), length) : length;
+
+            worker &target = *workers[string_utils::hash(path, key_length) % workers.size()];
+            target.pending.add(path, length, batch.get_time_ns(i), batch.get_mask(i));
+        }
+
+        batch.clear();
+
+        for (auto &target : workers) {
+            if (!target->pending.empty()) push_to(*target, target->pending);
+        }
+    }
+
+    void Event_dispatcher::push_to(worker &target, Event_batch &batch) {
+        Batch_queue &queue = *target.queue;
+
+        if (!queue.try_push(batch)) {
+            switch (policy) {
+                case backpressure_drop_oldest:
+                    while (!queue.try_push(batch)) {
+                        scratch.clear();
+
+                        if (queue.try_pop(scratch)) {
+                            ++dropped_batches;
+                            dropped_events += scratch.size();
+                        }
+                    }
+                    break;
+
+                case backpressure_coalesce:
+                    coalesce_queue(target, batch);
+                    break;
+
+                default:
+                    ++blocked_pushes;
+                    while (!queue.try_push(batch)) wait_for_space(target);
+                    break;
+            }
+        }
+
+        batch.clear();
+
+        size_t depth = queue.size();
+        if (depth > max_queue_depth) max_queue_depth = depth;
+
+        /* Pairs with the fence of the worker before it goes to sleep. */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (target.sleeping) {
+            std::lock_guard<std::mutex> sleep_guard(sleep_mutex);
+            target.batch_available.notify_one();
+        }
+    }
+
+    void Event_dispatcher::wait_for_space(worker &target) {
+        std::unique_lock<std::mutex> sleep_lock(sleep_mutex);
+
+        producer_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (target.queue->size() >= target.queue->capacity()) space_available.wait(sleep_lock);
+
+        producer_sleeping = false;
+    }
+
+    void Event_dispatcher::merge_into(Event_batch &target, const Event_batch &source) {
+        for (size_t i = 0; i < source.size(); ++i) {
+            fm_event_mask flags = source.get_mask(i);
+
+            /* Idle and overflow events are kept as they are. */
+            if (flags == NoOp || (flags & Overflow)) {
+                target.add(source.get_path(i), source.get_path_length(i), source.get_time_ns(i), flags);
+                continue;
+            }
+
+            key.assign(source.get_path(i), source.get_path_length(i));
+            auto found = merged_index.find(key);
+
+            if (found != merged_index.end()) {
+                target.set_mask(found->second, target.get_mask(found->second) | flags);
+                ++coalesced_events;
+                continue;
+            }
+
+            merged_index.emplace(key, target.size());
+            target.add(source.get_path(i), source.get_path_length(i), source.get_time_ns(i), flags);
+        }
+    }
+
+    void Event_dispatcher::coalesce_queue(worker &target, Event_batch &batch) {
+        merged.clear();
+        merged_index.clear();
+
+        /* The worker may pop concurrently: what is left is merged in order. */
+        for (;;) {
+            scratch.clear();
+            if (!target.queue->try_pop(scratch)) break;
+
+            merge_into(merged, scratch);
+        }
+
+        merge_into(merged, batch);
+        batch.clear();
+        batch.swap(merged);
+
+        while (!target.queue->try_push(batch)) wait_for_space(target);
+    }
+
+    void Event_dispatcher::deliver(Event_batch &batch) {
+        if (failed) {
+            ++dropped_batches;
+            dropped_events += batch.size();
+            return;
+        }
+
+        try {
+            function(batch);
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> error_guard(error_mutex);
+                if (!error) error = std::current_exception();
+            }
+
+            failed = true;
+            if (on_failure) on_failure();
+            return;
+        }
+
+        ++dispatched_batches;
+    }
+
+    void Event_dispatcher::dispatch_loop(worker &target) {
+        Batch_queue &queue = *target.queue;
+        Event_batch batch;
+
+        for (;;) {
+            batch.clear();
+
+            if (queue.try_pop(batch)) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (producer_sleeping) {
+                    std::lock_guard<std::mutex> sleep_guard(sleep_mutex);
+                    space_available.notify_all();
+                }
+
+                deliver(batch);
+                continue;
+            }
+
+            if (stopping) break;
+
+            std::unique_lock<std::mutex> sleep_lock(sleep_mutex);
+
+            target.sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (queue.size() == 0 && !stopping) target.batch_available.wait(sleep_lock);
+
+            target.sleeping = false;
+        }
+
+        /* Batches pushed before stop() was called are still delivered. */
+        for (;;) {
+            batch.clear();
+            if (!queue.try_pop(batch)) break;
+
+            deliver(batch);
+        }
+    }
+}
@@ -0,0 +1,174 @@
+/*
+ * @brief Header of the fm::Event_dispatcher class.
+ *
+ * This header file defines the fm::Event_dispatcher class, which delivers
+ * event batches to a callback from dedicated threads.
+ * */
+
+#ifndef FILE_MONITOR_EVENT_DISPATCHER_H
+#define FILE_MONITOR_EVENT_DISPATCHER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <cstddef>
+#include "event_batch.h"
+#include "batch_queue.h"
+
+namespace fm {
+    /*
+     * What a producer does when the dispatch queue is full.
+     * */
+    enum fm_backpressure_policy {
+        backpressure_block = 0,     /* Wait until the dispatcher frees a slot. */
+        backpressure_drop_oldest,   /* Drop the oldest queued batch. */
+        backpressure_coalesce       /* Merge the queued batches into one. */
+    };
+
+    /*
+     * @brief Asynchronous delivery of event batches.
+     *
+     * Producers push batches into a fm::Batch_queue and a worker thread pops
+     * them and invokes the dispatch function, so that a slow callback does not
+     * stall the thread detecting the events.  When the queue is full, the
+     * backpressure policy decides whether the producer waits, drops the oldest
+     * batch or merges the queued batches, one event per path with the flags
+     * OR-ed, to make room.
+     *
+     * With several workers, each has its own queue and the events of a batch
+     * are partitioned among them by a hash of their partition key: a prefix of
+     * their path, the whole path by default.  The events sharing a key are
+     * always delivered by the same worker, in order, while the dispatch
+     * function is invoked concurrently by the workers.
+     *
+     * Producers must be serialized by the caller; the workers only sleep when
+     * their queue is empty.
+     *
+     * If the dispatch function throws, the first exception is kept until
+     * rethrow_error() is called and the failure function is invoked, from the
+     * worker thread.  The batches that follow are dropped, so that producers
+     * are not blocked by a full queue.
+     * */
+    class Event_dispatcher {
+    public:
+        typedef std::function<void(Event_batch &)> dispatch_function;
+
+        /*
+         * Returns the length of the prefix of @p path events are partitioned
+         * by.
+         * */
+        typedef std::function<size_t(const char *path, size_t length)> partition_function;
+        typedef std::function<void()> failure_function;
+
+        static const size_t DEFAULT_QUEUE_SIZE = 64;
+
+        Event_dispatcher() = default;
+        ~Event_dispatcher();
+        Event_dispatcher(const Event_dispatcher &orig) = delete;
+        Event_dispatcher &operator=(const Event_dispatcher &that) = delete;
+
+        /*
+         * Starts @p worker_count workers, each with a queue of @p queue_size
+         * batches, which invoke @p function on every batch pushed.
+         * @p on_failure is invoked when @p function throws.
+         * */
+        void start(size_t queue_size,
+                   fm_backpressure_policy policy,
+                   unsigned int worker_count,
+                   dispatch_function function,
+                   partition_function partition = nullptr,
+                   failure_function on_failure = nullptr);
+
+        /*
+         * Delivers the queued batches and stops the workers.
+         * */
+        void stop();
+
+        bool is_running() const { return running; }
+
+        /*
+         * Rethrows the first exception thrown by the dispatch function since
+         * the dispatcher was started, if any, and forgets it.
+         * */
+        void rethrow_error();
+
+        /*
+         * Returns true if the dispatcher has been started, even if it has been
+         * stopped since.
+         * */
+        bool is_enabled() const { return enabled; }
+
+        /*
+         * Queues the events of @p batch, leaving it empty.
+         * */
+        void push(Event_batch &batch);
+
+        /*
+         * Parses the name of a backpressure policy: block, drop-oldest or
+         * coalesce.  It returns false if @p name is unknown.
+         * */
+        static bool parse_policy(const std::string &name, fm_backpressure_policy &policy);
+
+        unsigned long long get_dispatched_batches() const { return dispatched_batches; }
+        unsigned long long get_blocked_pushes() const { return blocked_pushes; }
+        unsigned long long get_dropped_batches() const { return dropped_batches; }
+        unsigned long long get_dropped_events() const { return dropped_events; }
+        unsigned long long get_coalesced_events() const { return coalesced_events; }
+        size_t get_max_queue_depth() const { return max_queue_depth; }
+
+    private:
+        struct worker {
+            std::unique_ptr<Batch_queue> queue;
+            std::thread thread;
+            std::atomic<bool> sleeping{false};
+            std::condition_variable batch_available;
+            Event_batch pending;                // events being partitioned, producer side
+        };
+
+        void dispatch_loop(worker &target);
+        void push_to(worker &target, Event_batch &batch);
+        void wait_for_space(worker &target);
+        void coalesce_queue(worker &target, Event_batch &batch);
+        void merge_into(Event_batch &target, const Event_batch &source);
+        void deliver(Event_batch &batch);
+
+        std::vector<std::unique_ptr<worker>> workers;
+        fm_backpressure_policy policy = backpressure_block;
+        dispatch_function function;
+        partition_function partition;
+        failure_function on_failure;
+
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        std::atomic<bool> enabled{false};
+        std::atomic<bool> running{false};
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> producer_sleeping{false};
+        std::mutex sleep_mutex;
+        std::condition_variable space_available;
+
+        /* Producer state, serialized by the caller. */
+        Event_batch scratch;
+        Event_batch merged;
+        std::unordered_map<std::string, size_t> merged_index;
+        std::string key;
+
+        std::atomic<unsigned long long> dispatched_batches{0};
+        std::atomic<unsigned long long> blocked_pushes{0};
+        std::atomic<unsigned long long> dropped_batches{0};
+        std::atomic<unsigned long long> dropped_events{0};
+        std::atomic<unsigned long long> coalesced_events{0};
+        std::atomic<size_t> max_queue_depth{0};
+    };
+}
+
+#endif //FILE_MONITOR_EVENT_DISPATCHER_H
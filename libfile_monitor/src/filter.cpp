@@ -31,8 +31,9 @@ namespace fm {
 		 *   - '+' or '-', to indicate whether the filter is an inclusion or an exclusion filter.
 		 *   - 'e', for an extended regular expression.
 		 *   - 'i', for a case insensitive regular expression.
+		 *   - 'g', for a glob pattern in gitignore syntax.
 		 */
-		regex filter_grammar("^([+-])([ei]*) (.+)$", regex_constants::extended);
+		regex filter_grammar("^([+-])([eig]*) (.+)$", regex_constants::extended);
 		smatch fragments;
 
 		if (!regex_match(filter, fragments, filter_grammar)) {
@@ -70,6 +71,9 @@ namespace fm {
 		    	case 'i':
 		     	 	filter_object.case_sensitive = false;
 		      		break;
+		    	case 'g':
+		      		filter_object.glob = true;
+		      		break;
 		    	default:
 		      		throw invalid_argument(string("Unknown flag: ") + c);
 		    }
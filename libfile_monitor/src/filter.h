@@ -32,6 +32,11 @@
  *
  *   - It can be an _extended_ regular expression (monitor_filter::extended).
  *
+ *   - It can be a _glob_ pattern in gitignore syntax instead of a regular
+ *     expression (monitor_filter::glob).  An exclusion glob ignores the paths
+ *     it matches and the subtrees below them, an inclusion glob re-includes
+ *     them as a negated gitignore rule does.
+ *
  * */
 namespace fm{
     enum fm_filter_type {
@@ -45,6 +50,7 @@ namespace fm{
         fm_filter_type type;
         bool case_sensitive;
         bool extended;
+        bool glob;
 
         /*
          * @brief Load filters from the specified file.
@@ -53,7 +59,7 @@ namespace fm{
          * A filter has the following structure:
          *
          *   - It is validated by the following regular expression:
-         *     `^([+-])([ei]*) (.+)$`
+         *     `^([+-])([eig]*) (.+)$`
          *
          *   - The first character is the filter type: `+` if it is an _inclusion_
          *     filter, `-` if it is an _exclusion_ filter.
@@ -64,6 +70,8 @@ namespace fm{
          *
          *     - `i` if it is a _case insensitive_ regular expression.
          *
+         *     - `g` if it is a glob pattern in gitignore syntax.
+         *
          *   - A space.
          *
          *   - The filter regular expression text.
@@ -0,0 +1,120 @@
+#include <cstring>
+#include "filter_cache.h"
+
+namespace fm {
+    static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    uint32_t Filter_cache::hash_path(const char *path, size_t length) {
+        /* Paths are hashed a word at a time: they are hashed on every lookup. */
+        const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+        uint64_t hash = length * multiplier;
+        uint64_t word;
+
+        for (; length >= sizeof(word); path += sizeof(word), length -= sizeof(word)) {
+            memcpy(&word, path, sizeof(word));
+            hash = (hash ^ word) * multiplier;
+            hash ^= hash >> 32;
+        }
+
+        word = 0;
+        memcpy(&word, path, length);
+        hash = (hash ^ word) * multiplier;
+
+        return static_cast<uint32_t>(hash ^ (hash >> 32));
+    }
+
+    size_t Filter_cache::find_slot(const char *path, size_t length, uint32_t hash) const {
+        const size_t mask = slots.size() - 1;
+
+        for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+            if (slots[slot] == EMPTY_SLOT) return slot;
+
+            const entry &current = entries[slots[slot]];
+
+            if (current.hash == hash && current.length == length &&
+                memcmp(&arena[current.offset], path, length) == 0) {
+                return slot;
+            }
+        }
+    }
+
+    void Filter_cache::reset() {
+        arena.clear();
+        entries.clear();
+        slots.clear();
+    }
+
+    void Filter_cache::set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+
+        this->capacity = capacity;
+        if (entries.size() > capacity) reset();
+    }
+
+    bool Filter_cache::lookup(const char *directory, size_t length, fm_subtree_verdict &verdict) {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+
+        if (!entries.empty()) {
+            size_t slot = find_slot(directory, length, hash_path(directory, length));
+
+            if (slots[slot] != EMPTY_SLOT) {
+                ++hits;
+                verdict = entries[slots[slot]].verdict;
+                return true;
+            }
+        }
+
+        ++misses;
+        return false;
+    }
+
+    void Filter_cache::insert(const char *directory, size_t length, fm_subtree_verdict verdict) {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+
+        if (capacity == 0 || length > UINT32_MAX) return;
+        if (entries.size() >= capacity) reset();
+
+        /* Keep the load factor at most 1/2. */
+        if ((entries.size() + 1) * 2 > slots.size()) {
+            size_t slot_count = slots.empty() ? 64 : slots.size() * 2;
+
+            slots.assign(slot_count, EMPTY_SLOT);
+
+            for (size_t i = 0; i < entries.size(); ++i) {
+                size_t slot = entries[i].hash & (slot_count - 1);
+                while (slots[slot] != EMPTY_SLOT) slot = (slot + 1) & (slot_count - 1);
+                slots[slot] = static_cast<uint32_t>(i);
+            }
+        }
+
+        uint32_t hash = hash_path(directory, length);
+        size_t slot = find_slot(directory, length, hash);
+
+        /* Another thread may have cached the directory in the meantime. */
+        if (slots[slot] != EMPTY_SLOT) return;
+
+        slots[slot] = static_cast<uint32_t>(entries.size());
+        entries.push_back({hash, static_cast<uint32_t>(length), arena.size(), verdict});
+        arena.insert(arena.end(), directory, directory + length);
+    }
+
+    void Filter_cache::clear() {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+        reset();
+    }
+
+    size_t Filter_cache::size() const {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+        return entries.size();
+    }
+
+    unsigned long long Filter_cache::get_hits() const {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+        return hits;
+    }
+
+    unsigned long long Filter_cache::get_misses() const {
+        std::lock_guard<std::mutex> cache_guard(cache_mutex);
+        return misses;
+    }
+}
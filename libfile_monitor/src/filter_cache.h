@@ -0,0 +1,77 @@
+/*
+ * @brief Header of the fm::Filter_cache class.
+ *
+ * This header file defines the fm::Filter_cache class, the cache of the
+ * filter verdicts of the directories observed by a monitor.
+ * */
+
+#ifndef FILE_MONITOR_FILTER_CACHE_H
+#define FILE_MONITOR_FILTER_CACHE_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "path_filter.h"
+
+namespace fm {
+    /*
+     * @brief Cache of the subtree verdicts of directories.
+     *
+     * Verdicts are stored in an open-addressing table keyed by the directory
+     * path, whose bytes are kept in a shared arena: a lookup hashes the path
+     * once and compares it once, without allocating.  An undecided verdict is
+     * cached as well: it tells that the paths below the directory must be
+     * checked, without checking the directory itself again.
+     *
+     * The cache is cleared when it is full and whenever the filters change.
+     * It is thread-safe.
+     * */
+    class Filter_cache {
+    public:
+        static const size_t DEFAULT_CAPACITY = 65536;
+
+        /*
+         * Sets the maximum number of cached directories, 0 to disable the
+         * cache.
+         * */
+        void set_capacity(size_t capacity);
+        bool is_enabled() const { return capacity > 0; }
+
+        /*
+         * Looks up the verdict of @p directory.  It returns false if the
+         * directory is not cached.
+         * */
+        bool lookup(const char *directory, size_t length, fm_subtree_verdict &verdict);
+
+        void insert(const char *directory, size_t length, fm_subtree_verdict verdict);
+        void clear();
+
+        size_t size() const;
+        unsigned long long get_hits() const;
+        unsigned long long get_misses() const;
+
+    private:
+        struct entry {
+            uint32_t hash;
+            uint32_t length;
+            size_t offset;                  // offset of the path in the arena
+            fm_subtree_verdict verdict;
+        };
+
+        static uint32_t hash_path(const char *path, size_t length);
+        size_t find_slot(const char *path, size_t length, uint32_t hash) const;
+        void reset();
+
+        mutable std::mutex cache_mutex;
+        std::vector<char> arena;
+        std::vector<entry> entries;
+        std::vector<uint32_t> slots;        // indices in entries, EMPTY_SLOT if unused
+        std::atomic<size_t> capacity{DEFAULT_CAPACITY};
+        unsigned long long hits = 0;
+        unsigned long long misses = 0;
+    };
+}
+
+#endif //FILE_MONITOR_FILTER_CACHE_H
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <fnmatch.h>
+#include "glob_filter.h"
+
+namespace fm {
+    static bool is_glob(const std::string &component) {
+        return component.find_first_of("*?[\\") != std::string::npos;
+    }
+
+    /*
+     * Splits @p path into components, skipping the empty and `.` ones.
+     * */
+    static std::vector<std::string> split_components(const std::string &path) {
+        std::vector<std::string> components;
+        size_t start = 0;
+
+        while (start <= path.size()) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos) end = path.size();
+
+            std::string component = path.substr(start, end - start);
+            if (!component.empty() && component != ".") components.push_back(std::move(component));
+
+            start = end + 1;
+        }
+
+        return components;
+    }
+
+    static int compare_name(const std::string &name, const char *other, size_t length) {
+        int result = memcmp(name.data(), other, std::min(name.size(), length));
+        if (result != 0) return result;
+        return (name.size() < length) ? -1 : (name.size() > length ? 1 : 0);
+    }
+
+    Glob_filter::Glob_filter() {
+        clear();
+    }
+
+    void Glob_filter::clear() {
+        nodes.assign(1, trie_node());
+        rules.clear();
+    }
+
+    uint32_t Glob_filter::find_child(uint32_t node, const char *name, size_t length) const {
+        const auto &children = nodes[node].children;
+        auto child = std::lower_bound(children.begin(), children.end(), std::make_pair(name, length),
+                                      [] (const std::pair<std::string, uint32_t> &entry,
+                                          const std::pair<const char *, size_t> &key) {
+                                          return compare_name(entry.first, key.first, key.second) < 0;
+                                      });
+
+        if (child == children.end() || compare_name(child->first, name, length) != 0) return npos;
+        return child->second;
+    }
+
+    uint32_t Glob_filter::add_child(uint32_t node, const std::string &component, bool case_sensitive) {
+        if (component == "**") {
+            if (nodes[node].double_star_child == npos) {
+                nodes.emplace_back();
+                nodes.back().is_double_star = true;
+                nodes[node].double_star_child = static_cast<uint32_t>(nodes.size() - 1);
+            }
+
+            return nodes[node].double_star_child;
+        }
+
+        if (case_sensitive && !is_glob(component)) return add_named_child(node, component);
+
+        int flags = case_sensitive ? 0 : FNM_CASEFOLD;
+
+        for (const wildcard_edge &edge : nodes[node].wildcard_children) {
+            if (edge.pattern == component && edge.flags == flags) return edge.node;
+        }
+
+        nodes.emplace_back();
+        uint32_t child = static_cast<uint32_t>(nodes.size() - 1);
+        nodes[node].wildcard_children.push_back({component, flags, child});
+        return child;
+    }
+
+    uint32_t Glob_filter::add_named_child(uint32_t node, const std::string &name) {
+        uint32_t child = find_child(node, name.data(), name.size());
+        if (child != npos) return child;
+
+        nodes.emplace_back();
+        child = static_cast<uint32_t>(nodes.size() - 1);
+
+        auto &children = nodes[node].children;
+        auto position = std::lower_bound(children.begin(), children.end(), name,
+                                         [] (const std::pair<std::string, uint32_t> &entry,
+                                             const std::string &other) {
+                                             return entry.first < other;
+                                         });
+        children.insert(position, {name, child});
+        return child;
+    }
+
+    bool Glob_filter::add_rule(const std::string &base,
+                               const std::string &pattern,
+                               bool case_sensitive,
+                               bool negate) {
+        std::string text(pattern);
+
+        if (!text.empty() && text.back() == '\r') text.pop_back();
+
+        /* Trailing spaces are ignored unless they are escaped. */
+        while (!text.empty() && text.back() == ' ' &&
+               !(text.size() > 1 && text[text.size() - 2] == '\\')) {
+            text.pop_back();
+        }
+
+        if (text.empty() || text[0] == '#') return false;
+
+        rule new_rule{negate, false};
+
+        if (text[0] == '!') {
+            new_rule.negated = !new_rule.negated;
+            text.erase(0, 1);
+        }
+
+        if (!text.empty() && text.back() == '/') {
+            new_rule.directory_only = true;
+            text.pop_back();
+        }
+
+        if (text.empty()) return false;
+
+        /* A rule without a slash but a trailing one matches at any depth. */
+        bool anchored = (text.find('/') != std::string::npos);
+        std::vector<std::string> components = split_components(text);
+
+        if (components.empty()) return false;
+        if (!anchored) components.insert(components.begin(), "**");
+
+        /* A trailing "**" matches everything inside, not the directory itself. */
+        if (components.back() == "**") components.insert(components.end() - 1, "*");
+
+        uint32_t node = 0;
+
+        /* The components of the base directory are names, not patterns. */
+        for (const std::string &component : split_components(base)) {
+            node = add_named_child(node, component);
+        }
+
+        for (const std::string &component : components) {
+            node = add_child(node, component, case_sensitive);
+        }
+
+        nodes[node].rules.push_back(static_cast<uint32_t>(rules.size()));
+        rules.push_back(new_rule);
+
+        return true;
+    }
+
+    bool Glob_filter::add_rules_from_file(const std::string &path, const std::string &base) {
+        std::ifstream file(path);
+
+        if (!file.is_open()) return false;
+
+        std::string line;
+
+        while (std::getline(file, line)) {
+            add_rule(base, line);
+        }
+
+        return true;
+    }
+
+    void Glob_filter::add_with_closure(std::vector<uint32_t> &active, uint32_t node) const {
+        while (node != npos) {
+            if (std::find(active.begin(), active.end(), node) != active.end()) return;
+
+            active.push_back(node);
+            node = nodes[node].double_star_child;
+        }
+    }
+
+    bool Glob_filter::is_ignored(const char *path, size_t length, bool is_dir) const {
+        if (rules.empty()) return false;
+
+        std::vector<uint32_t> active;
+        std::vector<uint32_t> next;
+        std::string component;
+
+        add_with_closure(active, 0);
+
+        size_t start = 0;
+
+        while (start < length) {
+            const char *separator = static_cast<const char *>(memchr(path + start, '/', length - start));
+            size_t end = separator ? static_cast<size_t>(separator - path) : length;
+            size_t component_length = end - start;
+            const char *name = path + start;
+
+            start = end + 1;
+
+            if (component_length == 0 || (component_length == 1 && name[0] == '.')) continue;
+
+            component.assign(name, component_length);
+            next.clear();
+
+            for (uint32_t node : active) {
+                const trie_node &current = nodes[node];
+
+                if (current.is_double_star) add_with_closure(next, node);
+
+                uint32_t child = find_child(node, name, component_length);
+                if (child != npos) add_with_closure(next, child);
+
+                for (const wildcard_edge &edge : current.wildcard_children) {
+                    if (fnmatch(edge.pattern.c_str(), component.c_str(), edge.flags) == 0) {
+                        add_with_closure(next, edge.node);
+                    }
+                }
+            }
+
+            active.swap(next);
+
+            if (active.empty()) return false;
+
+            /* The last matching rule decides. */
+            bool is_directory = is_dir || end < length;
+            uint32_t decision = npos;
+
+            for (uint32_t node : active) {
+                for (uint32_t rule_index : nodes[node].rules) {
+                    if (rules[rule_index].directory_only && !is_directory) continue;
+                    if (decision == npos || rule_index > decision) decision = rule_index;
+                }
+            }
+
+            /* Nothing below an excluded directory can be re-included. */
+            if (decision != npos && !rules[decision].negated) return true;
+        }
+
+        return false;
+    }
+}
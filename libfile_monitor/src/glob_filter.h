@@ -0,0 +1,117 @@
+/*
+ * @brief Header of the fm::Glob_filter class.
+ *
+ * This header file defines the fm::Glob_filter class, a set of ignore rules
+ * written with the syntax of .gitignore files.
+ * */
+
+#ifndef FILE_MONITOR_GLOB_FILTER_H
+#define FILE_MONITOR_GLOB_FILTER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace fm {
+    /*
+     * @brief Ignore rules in gitignore syntax, compiled into a component trie.
+     *
+     * Each rule applies below a base directory: the directory of the ignore
+     * file it was read from, or the beginning of the path for rules that do
+     * not come from a file.  The syntax is that of gitignore(5):
+     *
+     *   - Blank lines and lines starting with `#` are ignored.
+     *
+     *   - A leading `!` negates the rule: it re-includes what a previous rule
+     *     excluded.
+     *
+     *   - A trailing `/` restricts the rule to directories.
+     *
+     *   - A rule containing a `/` elsewhere is anchored to its base directory,
+     *     otherwise it matches at any depth below it.
+     *
+     *   - `*`, `?` and bracket expressions match within a path component and
+     *     `**` matches any number of components.
+     *
+     * The last matching rule decides, and rules added later take precedence:
+     * since ignore files are loaded while directories are crawled, the rules
+     * of a directory take precedence over those of its ancestors.  As in git,
+     * nothing below an excluded directory can be re-included, so a directory
+     * that is ignored can be pruned without being read.
+     *
+     * Rules are stored in a trie of path components shared by all the rules,
+     * starting with the components of their base directory: a path is matched
+     * against all the rules in a single walk of its components.  Empty and `.`
+     * components are skipped, so that paths and base directories must be
+     * spelled the same way, either both absolute or both relative to the same
+     * directory.
+     * */
+    class Glob_filter {
+    public:
+        Glob_filter();
+
+        /*
+         * Adds the rule @p pattern below @p base.  If @p negate is set, the
+         * meaning of the rule is inverted.  It returns false if @p pattern is a
+         * blank line or a comment.
+         * */
+        bool add_rule(const std::string &base,
+                      const std::string &pattern,
+                      bool case_sensitive = true,
+                      bool negate = false);
+
+        /*
+         * Adds the rules of the ignore file @p path below @p base.  It returns
+         * false if the file cannot be read.
+         * */
+        bool add_rules_from_file(const std::string &path, const std::string &base);
+
+        void clear();
+        bool empty() const { return rules.empty(); }
+        size_t size() const { return rules.size(); }
+
+        /*
+         * Returns true if @p path, or one of its ancestors, is excluded by the
+         * rules.  Every ancestor is a directory, while @p is_dir tells whether
+         * @p path is.
+         * */
+        bool is_ignored(const char *path, size_t length, bool is_dir) const;
+        bool is_ignored(const std::string &path, bool is_dir) const {
+            return is_ignored(path.data(), path.size(), is_dir);
+        }
+
+    private:
+        static const uint32_t npos = UINT32_MAX;
+
+        struct rule {
+            bool negated;
+            bool directory_only;
+        };
+
+        struct wildcard_edge {
+            std::string pattern;
+            int flags;          // fnmatch() flags
+            uint32_t node;
+        };
+
+        struct trie_node {
+            std::vector<std::pair<std::string, uint32_t>> children;   // sorted by name
+            std::vector<wildcard_edge> wildcard_children;
+            uint32_t double_star_child = npos;
+            bool is_double_star = false;
+            std::vector<uint32_t> rules;                             // rules ending here
+        };
+
+        uint32_t find_child(uint32_t node, const char *name, size_t length) const;
+        uint32_t add_child(uint32_t node, const std::string &component, bool case_sensitive);
+        uint32_t add_named_child(uint32_t node, const std::string &name);
+        void add_with_closure(std::vector<uint32_t> &nodes, uint32_t node) const;
+
+        std::vector<trie_node> nodes;
+        std::vector<rule> rules;
+    };
+}
+
+#endif //FILE_MONITOR_GLOB_FILTER_H
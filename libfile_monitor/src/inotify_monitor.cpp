@@ -1,184 +1,484 @@
 #include <sstream>
+#include <algorithm>
 #include <ctime>
 #include <cmath>
 #include <set>
-#include <map>
-#include <sys/select.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <limits.h>
 #include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include "exception.h"
 #include "path_utils.h"
 #include "monitor.h"
 #include "log.h"
 #include "inotify_monitor.h"
+#include "watch_table.h"
+#include "crawler.h"
+#include "string_utils.h"
 
 using namespace std;
 
 namespace fm {
 
-    struct inotify_monitor_impl {
+    /*
+     * An inotify instance watching a part of the tree, drained by its own
+     * thread.
+     */
+    struct inotify_shard {
         int inotify_monitor_handle = -1;
-        std::vector<Event> events;
+        int epoll_handle = -1;
+        std::thread thread;
+
+        /*
+         * The watch table is updated by the threads scanning new directories,
+         * whichever shard they belong to: watch_mutex is held to update it and
+         * by the shard thread while it preprocesses the events it reads.
+         */
+        Path_tree watched_paths;
+        Watch_table watches{watched_paths};
+        std::mutex watch_mutex;
+
+        /*
+         * The following members are only used by the shard thread.
+         */
+        Event_batch events;
 
-        set<int> watched_descriptors;
-        map<string ,int> path_to_wd;
+        /*
+         * Path of the event being preprocessed, reused across events.
+         */
+        string event_path;
 
-        map<int, string> wd_to_path;
         set<int> descriptors_to_remove;
         set<int> watches_to_remove;
         vector<string> paths_to_rescan;
-        time_t curr_time;
+
+        /*
+         * Directories moved to another shard, whose subdirectories are still
+         * watched by their former shard under their old paths.
+         */
+        vector<string> moved_out_paths;
+
+        /*
+         * Crawler used to scan new directories, which visits files too in
+         * order to report them.
+         */
+        std::unique_ptr<Directory_crawler> new_directory_crawler;
+        struct timespec curr_time;
+
+        /*
+         * Read buffer, sized with FIONREAD and reused across iterations.
+         */
+        vector<char> read_buffer;
+    };
+
+    struct inotify_monitor_impl {
+        /*
+         * The first shard is drained by the thread running the monitor, the
+         * others by threads of their own.
+         */
+        vector<std::unique_ptr<inotify_shard>> shards;
+
+        /*
+         * Crawler used by scan_root_paths(), configured when the monitor is
+         * started, which only visits directories.
+         */
+        std::unique_ptr<Directory_crawler> crawler;
+
+        /* Event mask of the watches, derived from the configuration. */
+        uint32_t watch_mask = IN_ALL_EVENTS;
+
+        /*
+         * Directory moves seen by a single shard so far, by cookie.  The two
+         * halves of a move between directories of different shards are read
+         * by different shards, in any order.
+         */
+        struct move_half {
+            string path;
+            bool moved_from;
+            std::chrono::steady_clock::time_point seen;
+        };
+
+        std::unordered_map<uint32_t, move_half> move_halves;
+        std::mutex move_halves_mutex;
+
+        /* First error thrown by a shard thread, rethrown by run(). */
+        std::exception_ptr shard_error;
+        std::mutex shard_error_mutex;
     };
 
+    /*
+     * Minimum size of the read buffer: it must be able to hold at least one
+     * event with the longest name.
+     */
     static const unsigned int BUFFER_SIZE = (10 * 10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
 
+    /*
+     * Upper bound of the read buffer: FIONREAD may report the whole queue, which
+     * is then drained with multiple reads of at most this size.
+     */
+    static const size_t MAX_BUFFER_SIZE = 16 * 1024 * 1024;
+
+    /*
+     * Maximum number of reads performed on a single wakeup, so that a monitor
+     * under sustained load still delivers its events periodically.
+     */
+    static const unsigned int MAX_DRAIN_READS = 1024;
+
+    /*
+     * Time after which the half of a directory move that was not matched, such
+     * as a move into or out of the watched tree, is forgotten.
+     */
+    static const std::chrono::seconds MOVE_HALF_TIMEOUT(60);
+
+    /* Events reported as PlatformSpecific only when accesses are watched. */
+    static const uint32_t ACCESS_EVENTS = IN_ACCESS | IN_OPEN | IN_CLOSE_NOWRITE;
+
     Inotify_monitor::Inotify_monitor(std::vector <string> paths,
                                      FM_EVENT_CALLBACK *callback,
                                      void *context) :
        Monitor(paths, callback, context),
        impl(new inotify_monitor_impl())
                                      {
-        impl->inotify_monitor_handle = inotify_init();
-        if (impl->inotify_monitor_handle == -1) {
-            perror("inotify init");
-            throw fm_exception(string("Cannot initialize inotify."));
+        try {
+            impl->shards.push_back(create_shard());
+        } catch (...) {
+            delete impl;
+            throw;
         }
     }
 
     Inotify_monitor::~Inotify_monitor() {
-        for (auto inotify_desc_pair : impl->watched_descriptors) {
-            if (inotify_rm_watch(impl->inotify_monitor_handle, inotify_desc_pair)) {
-                perror("inotify_rm_watch");
+        for (auto &shard : impl->shards) {
+            shard->watches.for_each([&shard] (int wd) {
+                if (inotify_rm_watch(shard->inotify_monitor_handle, wd)) {
+                    perror("inotify_rm_watch");
+                }
+            });
+
+            if (shard->inotify_monitor_handle > 0) {
+                close(shard->inotify_monitor_handle);
             }
+            close(shard->epoll_handle);
         }
 
-        if (impl->inotify_monitor_handle > 0) {
-            close(impl->inotify_monitor_handle);
-        }
         delete impl;
     }
 
-    bool Inotify_monitor::add_watch(const std::string &path, const struct stat &fd_stat) {
-        int inotify_desc = inotify_add_watch(impl->inotify_monitor_handle,
+    std::unique_ptr<inotify_shard> Inotify_monitor::create_shard() {
+        std::unique_ptr<inotify_shard> shard(new inotify_shard());
+        shard->read_buffer.resize(BUFFER_SIZE);
+        add_statistic("inotify.buffer_bytes", BUFFER_SIZE);
+
+        shard->inotify_monitor_handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (shard->inotify_monitor_handle == -1) {
+            perror("inotify init");
+            throw fm_exception(string("Cannot initialize inotify."));
+        }
+
+        /*
+         * The run loop waits on an epoll set made of the inotify descriptor and
+         * of the monitor wakeup channel, so that events are processed as soon
+         * as they are available instead of at the next latency tick, and stop()
+         * is honoured immediately.
+         */
+        shard->epoll_handle = epoll_create1(EPOLL_CLOEXEC);
+
+        struct epoll_event inotify_event_desc = {};
+        inotify_event_desc.events = EPOLLIN;
+        inotify_event_desc.data.fd = shard->inotify_monitor_handle;
+
+        struct epoll_event wakeup_event_desc = {};
+        wakeup_event_desc.events = EPOLLIN;
+        wakeup_event_desc.data.fd = get_wakeup_fd();
+
+        if (shard->epoll_handle == -1 ||
+            epoll_ctl(shard->epoll_handle, EPOLL_CTL_ADD, shard->inotify_monitor_handle, &inotify_event_desc) ||
+            epoll_ctl(shard->epoll_handle, EPOLL_CTL_ADD, get_wakeup_fd(), &wakeup_event_desc)) {
+            perror("epoll");
+            if (shard->epoll_handle != -1) close(shard->epoll_handle);
+            close(shard->inotify_monitor_handle);
+            throw fm_exception(string("Cannot initialize the inotify event loop."));
+        }
+
+        return shard;
+    }
+
+    inotify_shard &Inotify_monitor::get_shard(const std::string &path) const {
+        if (impl->shards.size() == 1) return *impl->shards[0];
+
+        size_t key_length = get_top_directory_length(path.c_str(), path.size());
+        return *impl->shards[string_utils::hash(path.c_str(), key_length) % impl->shards.size()];
+    }
+
+    uint32_t Inotify_monitor::get_watch_mask() const {
+        /* Events required to maintain the watch table. */
+        uint32_t mask = IN_DELETE_SELF | IN_MOVE_SELF;
+
+        /* New directories must be seen to be watched. */
+        if (recursive) mask |= IN_CREATE | IN_MOVED_TO;
+
+        if (accept_event_type(fm_event_flag::Created)) mask |= IN_CREATE | IN_MOVED_TO;
+        if (accept_event_type(fm_event_flag::Updated)) mask |= IN_MODIFY | IN_CLOSE_WRITE;
+        if (accept_event_type(fm_event_flag::Removed)) mask |= IN_DELETE | IN_MOVED_FROM;
+        if (accept_event_type(fm_event_flag::AttributeModified)) mask |= IN_ATTRIB;
+        if (accept_event_type(fm_event_flag::MovedFrom)) mask |= IN_MOVED_FROM;
+        if (accept_event_type(fm_event_flag::MovedTo)) mask |= IN_MOVED_TO;
+
+        /* IsDir may be set on any event but the access ones. */
+        if (accept_event_type(fm_event_flag::IsDir)) mask |= IN_ALL_EVENTS & ~ACCESS_EVENTS;
+
+        /* Access events are only reported if requested. */
+        if (watch_access && accept_event_type(fm_event_flag::PlatformSpecific)) mask |= ACCESS_EVENTS;
+
+        /* Unlinked children of a watched directory no longer generate events. */
+        return mask | IN_EXCL_UNLINK;
+    }
+
+    bool Inotify_monitor::add_watch(inotify_shard &shard, const std::string &path, const struct stat &fd_stat) {
+        uint32_t mask = impl->watch_mask;
+
+        /*
+         * A directory may be replaced by another object after it was scanned:
+         * the watch is only added if it is still a directory.
+         */
+        if (S_ISDIR(fd_stat.st_mode)) mask |= IN_ONLYDIR;
+
+        /*
+         * A directory that is already watched, such as a subdirectory of a
+         * moved directory, gets its existing descriptor back: the watch is then
+         * moved to the new path.
+         */
+        int inotify_desc = inotify_add_watch(shard.inotify_monitor_handle,
                                             path.c_str(),
-                                            IN_ALL_EVENTS);
+                                            mask);
 
         if (inotify_desc == -1) {
             perror("inotify_add_watch");
         } else {
-            impl->watched_descriptors.insert(inotify_desc);
-            impl->wd_to_path[inotify_desc] = path;
-            impl->path_to_wd[path] = inotify_desc;
+            shard.watches.insert(inotify_desc, path);
         }
         return (inotify_desc != -1);
     }
 
-    void Inotify_monitor::scan(const std::string &path, const bool accept_non_dirs) {
-        struct stat fd_stat;
-        if (!lstat_path(path, fd_stat)) return;
+    unsigned long long Inotify_monitor::scan(const std::string &path,
+                                             const bool accept_non_dirs,
+                                             inotify_shard *reporter) {
+        Directory_crawler &crawler = reporter ? *reporter->new_directory_crawler : *impl->crawler;
 
-        if (follow_symlinks && S_ISLNK(fd_stat.st_mode)) {
-            string link_path;
-            if (read_link_path(path, link_path)) {
-                scan(link_path, accept_non_dirs);
-            }
-            return;
-        }
+        return crawler.crawl(path, [this, accept_non_dirs, reporter] (const std::string &node_path,
+                                                                      const struct stat &fd_stat,
+                                                                      bool is_root) {
+            /*
+             * Symbolic links are resolved by the crawler, which scans their
+             * target: the link itself is not watched.
+             */
+            if (follow_symlinks && S_ISLNK(fd_stat.st_mode)) return false;
 
-        bool is_dir = S_ISDIR(fd_stat.st_mode);
+            bool is_dir = S_ISDIR(fd_stat.st_mode);
 
-        /*
-         * When watching a directory the inotify API will return change events of
-         * first-level children.  Therefore, we do not need to manually add a watch
-         * for a child unless it is a directory.  By default, accept_non_dirs is
-         * true to allow watching a file when first invoked on a node.
-         *
-         * For the same reason, the directory_only flag is ignored and treated as if
-         * it were always set to true.
-         */
-        if (!is_dir && !accept_non_dirs) return; // not only accept dir
-        if (!is_dir && directory_only) return;   // only directory
-        if (!accept_path(path)) return;
-        if (!add_watch(path, fd_stat)) return;
-        if (!recursive || !is_dir) return;       // not recursive or not dir
-
-        std::vector<std::string> children = get_directory_children(path);
+            /*
+             * When watching a directory the inotify API will return change events of
+             * first-level children.  Therefore, we do not need to manually add a watch
+             * for a child unless it is a directory.  By default, accept_non_dirs is
+             * true to allow watching a file when first invoked on a node.
+             *
+             * For the same reason, the directory_only flag is ignored and treated as if
+             * it were always set to true.
+             */
+            if (!is_dir && directory_only) return false;   // only directory
+            if (!accept_path(node_path, is_dir)) return false;
 
-        for (const std::string& child : children)
-        {
-            if (child == "." || child == "..") continue;
+            inotify_shard &shard = get_shard(node_path);
+            std::unique_lock<std::mutex> watch_guard(shard.watch_mutex);
 
             /*
-             * Scan children but only watch directories.
+             * The entries of a new directory may have been created before its
+             * watch was added: their creation is reported here since inotify
+             * will not.  The new directory itself was reported by its parent.
+             * The crawler of a new directory runs a single thread, blocking
+             * the thread of the reporting shard.
              */
-            scan(path + "/" + child, false);
-        }
+            if (reporter && !is_root && shard.watches.find_wd(node_path) == -1)
+            {
+                reporter->events.add(node_path, reporter->curr_time, fm_event_flag::Created);
+            }
+
+            if (!is_dir && !(is_root && accept_non_dirs)) return false; // not only accept dir
+
+            /* Watched directories have been scanned already. */
+            if (is_dir && shard.watches.find_wd(node_path) != -1) return false;
+            if (!add_watch(shard, node_path, fd_stat)) return false;
+            if (!recursive || !is_dir) return false;       // not recursive or not dir
+
+            watch_guard.unlock();
+            load_ignore_file(node_path);
+
+            return true;
+        });
     }
 
     bool Inotify_monitor::is_watched(const std::string &path) const {
-        return (impl->path_to_wd.find(path) != impl->path_to_wd.end());
+        inotify_shard &shard = get_shard(path);
+        std::lock_guard<std::mutex> watch_guard(shard.watch_mutex);
+
+        return (shard.watches.find_wd(path) != -1);
     }
 
     void Inotify_monitor::scan_root_paths() {
         for (string &path : paths) {
-            if (!is_watched(path)) scan(path);
+            if (is_watched(path)) continue;
+
+            auto scan_start = std::chrono::steady_clock::now();
+            unsigned long long visited = scan(path);
+            auto scan_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - scan_start);
+
+            set_statistic("scan.time_ms:" + path, scan_time.count());
+            set_statistic("scan.nodes:" + path, visited);
         }
     }
 
-    void Inotify_monitor::preprocess_dir_event(struct inotify_event *event) {
-        vector<fm_event_flag> flags;
+    void Inotify_monitor::preprocess_dir_event(inotify_shard &shard, struct inotify_event *event) {
+        if (!shard.watches.get_path(event->wd, shard.event_path)) return;
+
+        fm_event_mask flags = NoOp;
 
-        if (event->mask & IN_ISDIR) flags.push_back(fm_event_flag::IsDir);
-        if (event->mask & IN_MOVE_SELF) flags.push_back(fm_event_flag::Updated);
-        if (event->mask & IN_UNMOUNT) flags.push_back(fm_event_flag::PlatformSpecific);
+        if (event->mask & IN_ISDIR) flags |= fm_event_flag::IsDir;
+        if (event->mask & IN_MOVE_SELF) flags |= fm_event_flag::Updated;
+        if (event->mask & IN_UNMOUNT) flags |= fm_event_flag::PlatformSpecific;
 
-        if (flags.size())
+        if (flags != NoOp)
         {
-            impl->events.push_back({impl->wd_to_path[event->wd], impl->curr_time, flags});
+            shard.events.add(shard.event_path, shard.curr_time, flags);
         }
 
-        // If a new directory has been created, it should be rescanned if the
-        if ((event->mask & IN_ISDIR) && (event->mask & IN_CREATE))
+        /*
+         * A directory created or moved into a watched directory must be scanned
+         * to be watched if the monitor is recursive.  Only the new directory is
+         * scanned, not its parent.
+         */
+        if (recursive && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len > 1)
         {
-            impl->paths_to_rescan.push_back(impl->wd_to_path[event->wd]);
+            shard.paths_to_rescan.push_back(shard.event_path + "/" + event->name);
+        }
+
+        if (recursive && impl->shards.size() > 1 && (event->mask & IN_ISDIR) &&
+            (event->mask & (IN_MOVED_FROM | IN_MOVED_TO)) && event->cookie && event->len > 1)
+        {
+            match_directory_move(shard, event, shard.event_path + "/" + event->name);
         }
     }
 
-    void Inotify_monitor::preprocess_node_event(struct inotify_event *event) {
-        vector<fm_event_flag> flags;
+    void Inotify_monitor::match_directory_move(inotify_shard &shard,
+                                               const struct inotify_event *event,
+                                               const std::string &path) {
+        const bool moved_from = (event->mask & IN_MOVED_FROM) != 0;
+        const auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> move_guard(impl->move_halves_mutex);
+        auto other = impl->move_halves.find(event->cookie);
+
+        if (other == impl->move_halves.end() || other->second.moved_from == moved_from) {
+            for (auto half = impl->move_halves.begin(); half != impl->move_halves.end();) {
+                if (now - half->second.seen > MOVE_HALF_TIMEOUT) {
+                    half = impl->move_halves.erase(half);
+                } else {
+                    ++half;
+                }
+            }
+
+            impl->move_halves[event->cookie] = {path, moved_from, now};
+            return;
+        }
+
+        const string &from = moved_from ? path : other->second.path;
+        const string &to = moved_from ? other->second.path : path;
+
+        /*
+         * Within a shard, the rescan of the new path moves the existing watches
+         * to it.  Across shards, it adds watches of its own.
+         */
+        if (&get_shard(from) != &get_shard(to)) shard.moved_out_paths.push_back(from);
+
+        impl->move_halves.erase(other);
+    }
+
+    void Inotify_monitor::remove_moved_watches(const std::string &path) {
+        inotify_shard &owner = get_shard(path);
+        std::lock_guard<std::mutex> watch_guard(owner.watch_mutex);
+
+        const Path_tree::node_id moved = owner.watched_paths.find(path);
+        if (moved == Path_tree::npos) return;
+
+        vector<int> stale;
+
+        owner.watches.for_each([&owner, &stale, moved] (int wd) {
+            Path_tree::node_id node = owner.watches.find_node(wd);
+
+            /* The watch of the moved directory is removed by IN_MOVE_SELF. */
+            if (node == moved) return;
 
-        if (event->mask & IN_ACCESS) flags.push_back(fm_event_flag::PlatformSpecific);
-        if (event->mask & IN_ATTRIB) flags.push_back(fm_event_flag::AttributeModified);
-        if (event->mask & IN_CLOSE_NOWRITE) flags.push_back(fm_event_flag::PlatformSpecific);
-        if (event->mask & IN_CLOSE_WRITE) flags.push_back(fm_event_flag::Updated);
-        if (event->mask & IN_CREATE) flags.push_back(fm_event_flag::Created);
-        if (event->mask & IN_DELETE) flags.push_back(fm_event_flag::Removed);
-        if (event->mask & IN_MODIFY) flags.push_back(fm_event_flag::Updated);
+            while (node != Path_tree::npos && node != moved) node = owner.watched_paths.get_parent(node);
+            if (node == moved) stale.push_back(wd);
+        });
+
+        for (int wd : stale) {
+            if (inotify_rm_watch(owner.inotify_monitor_handle, wd) != 0) {
+                perror("inotify_rm_watch");
+            }
+
+            owner.watches.erase(wd);
+        }
+
+        add_statistic("inotify.moved_out_watches", stale.size());
+    }
+
+    void Inotify_monitor::preprocess_node_event(inotify_shard &shard, struct inotify_event *event) {
+        /* Events of watches removed in the meantime are discarded. */
+        if (!shard.watches.get_path(event->wd, shard.event_path)) return;
+
+        fm_event_mask flags = NoOp;
+
+        if (event->mask & IN_ACCESS) flags |= fm_event_flag::PlatformSpecific;
+        if (event->mask & IN_ATTRIB) flags |= fm_event_flag::AttributeModified;
+        if (event->mask & IN_CLOSE_NOWRITE) flags |= fm_event_flag::PlatformSpecific;
+        if (event->mask & IN_CLOSE_WRITE) flags |= fm_event_flag::Updated;
+        if (event->mask & IN_CREATE) flags |= fm_event_flag::Created;
+        if (event->mask & IN_DELETE) flags |= fm_event_flag::Removed;
+        if (event->mask & IN_MODIFY) flags |= fm_event_flag::Updated;
         if (event->mask & IN_MOVED_FROM)
         {
-            flags.push_back(fm_event_flag::Removed);
-            flags.push_back(fm_event_flag::MovedFrom);
+            flags |= fm_event_flag::Removed;
+            flags |= fm_event_flag::MovedFrom;
         }
         if (event->mask & IN_MOVED_TO)
         {
-            flags.push_back(fm_event_flag::Created);
-            flags.push_back(fm_event_flag::MovedTo);
+            flags |= fm_event_flag::Created;
+            flags |= fm_event_flag::MovedTo;
         }
-        if (event->mask & IN_OPEN) flags.push_back(fm_event_flag::PlatformSpecific);
+        if (event->mask & IN_OPEN) flags |= fm_event_flag::PlatformSpecific;
 
         /* build the file name */
-        ostringstream filename_stream;
-        filename_stream << impl->wd_to_path[event->wd];
+        string &filename = shard.event_path;
 
         if (event->len > 1)
         {
-            filename_stream << "/";
-            filename_stream << event->name;
+            filename += '/';
+            filename += event->name;
         }
 
-        if (flags.size())
+        if (flags != NoOp)
         {
-            impl->events.push_back({filename_stream.str(), impl->curr_time, flags});
+            shard.events.add(filename, shard.curr_time, flags);
         }
 
         /*
@@ -187,7 +487,7 @@ namespace fm {
          */
         if (event->mask & IN_IGNORED)
         {
-            impl->descriptors_to_remove.insert(event->wd);
+            shard.descriptors_to_remove.insert(event->wd);
         }
 
         /*
@@ -204,8 +504,8 @@ namespace fm {
          */
         if (event->mask & IN_MOVE_SELF)
         {
-            impl->watches_to_remove.insert(event->wd);
-            impl->descriptors_to_remove.insert(event->wd);
+            shard.watches_to_remove.insert(event->wd);
+            shard.descriptors_to_remove.insert(event->wd);
         }
 
         /*
@@ -220,149 +520,346 @@ namespace fm {
         if (event->mask & IN_DELETE_SELF)
         {
             std::ostringstream log;
-            log << "IN_DELETE_SELF: " << event->wd << "::" << filename_stream.str() << "\n";
+            log << "IN_DELETE_SELF: " << event->wd << "::" << filename << "\n";
             FM_ELOG(log.str().c_str());
 
-            impl->descriptors_to_remove.insert(event->wd);
+            shard.descriptors_to_remove.insert(event->wd);
         }
     }
 
-    void Inotify_monitor::preprocess_event(struct inotify_event *event)
+    void Inotify_monitor::preprocess_event(inotify_shard &shard, struct inotify_event *event)
     {
         if (event->mask & IN_Q_OVERFLOW)
         {
-            notify_overflow(impl->wd_to_path[event->wd]);
+            string overflow_path;
+            shard.watches.get_path(event->wd, overflow_path);
+            notify_overflow(overflow_path);
         }
 
-        preprocess_dir_event(event);
-        preprocess_node_event(event);
+        preprocess_dir_event(shard, event);
+        preprocess_node_event(shard, event);
     }
 
-    void Inotify_monitor::remove_watch(int wd)
-    {
-        /*
-         * No need to remove the inotify watch because it is removed automatically
-         * when a watched element is deleted.
-         */
-        impl->wd_to_path.erase(wd);
-    }
-
-    void Inotify_monitor::process_pending_events()
+    void Inotify_monitor::process_pending_events(inotify_shard &shard)
     {
         // Remove watches.
-        auto wtd = impl->watches_to_remove.begin();
-        while (wtd != impl->watches_to_remove.end())
+        auto wtd = shard.watches_to_remove.begin();
+        while (wtd != shard.watches_to_remove.end())
         {
-            if (inotify_rm_watch(impl->inotify_monitor_handle, *wtd) != 0)
+            if (inotify_rm_watch(shard.inotify_monitor_handle, *wtd) != 0)
             {
                 perror("inotify_rm_watch");
             }
 
-            impl->watches_to_remove.erase(wtd++);
+            shard.watches_to_remove.erase(wtd++);
         }
 
         // Clean up descriptors.
-        auto fd = impl->descriptors_to_remove.begin();
-        while (fd != impl->descriptors_to_remove.end())
+        if (!shard.descriptors_to_remove.empty())
         {
-            const std::string& curr_path = impl->wd_to_path[*fd];
-            impl->path_to_wd.erase(curr_path);
-            impl->wd_to_path.erase(*fd);
-            impl->watched_descriptors.erase(*fd);
+            std::lock_guard<std::mutex> watch_guard(shard.watch_mutex);
 
-            impl->descriptors_to_remove.erase(fd++);
+            for (int fd : shard.descriptors_to_remove) shard.watches.erase(fd);
+            shard.descriptors_to_remove.clear();
         }
 
-        // Process paths to be rescanned
-        std::for_each(impl->paths_to_rescan.begin(),
-                      impl->paths_to_rescan.end(),
-                      [this] (const std::string& p)
-                      {
-                          this->scan(p);
-                      }
-        );
+        // Remove the watches left behind by directories moved to another shard.
+        for (const string &path : shard.moved_out_paths) remove_moved_watches(path);
+        shard.moved_out_paths.clear();
+
+        // Process paths to be rescanned, once each.  A directory is skipped if
+        // one of its ancestors is queued as well, since it is scanned with it.
+        if (!shard.paths_to_rescan.empty())
+        {
+            vector<string> &rescan = shard.paths_to_rescan;
+            std::sort(rescan.begin(), rescan.end());
+            rescan.erase(std::unique(rescan.begin(), rescan.end()), rescan.end());
+
+            std::unordered_set<string> queued(rescan.begin(), rescan.end());
+
+            for (const string &path : rescan)
+            {
+                bool ancestor_queued = false;
+
+                for (size_t separator = path.find('/', 1);
+                     separator != string::npos && !ancestor_queued;
+                     separator = path.find('/', separator + 1))
+                {
+                    ancestor_queued = queued.count(path.substr(0, separator)) > 0;
+                }
+
+                if (!ancestor_queued) scan(path, false, &shard);
+            }
+
+            rescan.clear();
+            set_statistic("inotify.rescanned_directories", queued.size());
+        }
+
+        // The watch counters are the totals of the shards.
+        size_t watch_count = 0;
+        size_t watch_table_bytes = 0;
+        size_t path_tree_nodes = 0;
+        size_t path_tree_bytes = 0;
+
+        for (auto &current : impl->shards)
+        {
+            std::lock_guard<std::mutex> watch_guard(current->watch_mutex);
+
+            watch_count += current->watches.size();
+            watch_table_bytes += current->watches.memory_usage();
+            path_tree_nodes += current->watched_paths.size();
+            path_tree_bytes += current->watched_paths.memory_usage();
+        }
 
-        impl->paths_to_rescan.clear();
+        set_statistic("inotify.watch_count", watch_count);
+        set_statistic("inotify.watch_table_bytes", watch_table_bytes);
+        set_statistic("inotify.path_tree_nodes", path_tree_nodes);
+        set_statistic("inotify.path_tree_bytes", path_tree_bytes);
     }
 
-    void Inotify_monitor::run()
+    int Inotify_monitor::wait_for_events(inotify_shard &shard, int timeout_ms)
     {
-        char buffer[BUFFER_SIZE];
-        double sec;
-        double frac = modf(this->latency, &sec);
+        struct epoll_event ready[2];
+        int ready_num = epoll_wait(shard.epoll_handle, ready, 2, timeout_ms);
 
-        for(;;)
-        {
-            std::unique_lock<std::mutex> run_guard(run_mutex);
-            if (should_stop) break;
-            run_guard.unlock();
+        if (ready_num == -1) {
+            if (errno == EINTR) return 0;
+            perror("epoll_wait()");
+            throw fm_exception(string("epoll_wait() on inotify descriptor returned -1."));
+        }
 
-            process_pending_events();
+        /*
+         * The wakeup channel stays readable until the monitor is stopped: the
+         * caller is expected to check Monitor::should_stop.
+         */
+        for (int i = 0; i < ready_num; ++i) {
+            if (ready[i].data.fd == shard.inotify_monitor_handle) return 1;
+        }
 
-            scan_root_paths();
+        return 0;
+    }
 
-            // If no files can be watched, sleep and repeat the loop.
-            if (!impl->watched_descriptors.size())
-            {
-                sleep(latency);
-                continue;
-            }
+    bool Inotify_monitor::drain_events(inotify_shard &shard)
+    {
+        unsigned long long read_count = 0;
+        size_t last_read_size = 0;
+        size_t max_read_size = 0;
+        const size_t buffer_size = shard.read_buffer.size();
 
-            // Use select to timeout on file descriptor read the amount specified by
-            // the monitor latency.  This way, the monitor has a chance to update its
-            // watches with at least the periodicity expected by the user.
-            fd_set set;
-            struct timeval timeout;
-
-            FD_ZERO(&set);
-            FD_SET(impl->inotify_monitor_handle, &set);
-            timeout.tv_sec = sec;
-            timeout.tv_usec = 1000 * 1000 * frac;
-
-            int rv = select(impl->inotify_monitor_handle + 1,
-                            &set,
-                            nullptr,
-                            nullptr,
-                            &timeout);
-
-            if (rv == -1) {
-                continue;
+        for (unsigned int reads = 0; reads < MAX_DRAIN_READS; ++reads)
+        {
+            int available = 0;
+            if (ioctl(shard.inotify_monitor_handle, FIONREAD, &available) == -1) {
+                available = 0;
             }
 
-            // In case of read timeout just repeat the loop.
-            if (rv == 0) continue;
+            size_t wanted = std::min(MAX_BUFFER_SIZE,
+                                     std::max(static_cast<size_t>(available),
+                                              static_cast<size_t>(BUFFER_SIZE)));
+            if (shard.read_buffer.size() < wanted) shard.read_buffer.resize(wanted);
 
-            ssize_t record_num = read(impl->inotify_monitor_handle,
+            char *buffer = shard.read_buffer.data();
+            ssize_t record_num = read(shard.inotify_monitor_handle,
                                       buffer,
-                                      BUFFER_SIZE);
+                                      shard.read_buffer.size());
 
             if (!record_num) {
                 throw fm_exception(string("read() on inotify descriptor read 0 records."));
             }
 
             if (record_num == -1) {
+                if (errno == EAGAIN || errno == EINTR) break;
+
                 perror("read()");
                 throw fm_exception(string("read() on inotify descriptor returned -1."));
             }
 
-            time(&impl->curr_time);
+            ++read_count;
+            last_read_size = static_cast<size_t>(record_num);
+            max_read_size = std::max(max_read_size, last_read_size);
+
+            clock_gettime(CLOCK_REALTIME, &shard.curr_time);
+
+            std::lock_guard<std::mutex> watch_guard(shard.watch_mutex);
 
             for (char *p = buffer; p < buffer + record_num;)
             {
                 struct inotify_event *event = reinterpret_cast<struct inotify_event *> (p);
 
-                preprocess_event(event);
+                preprocess_event(shard, event);
 
                 p += (sizeof(struct inotify_event)) + event->len;
             }
+        }
 
-            if (impl->events.size())
+        if (read_count)
+        {
+            add_statistic("inotify.read_count", read_count);
+            set_statistic("inotify.last_read_bytes", last_read_size);
+            max_statistic("inotify.max_read_bytes", max_read_size);
+
+            if (shard.read_buffer.size() > buffer_size)
             {
-                notify_events(impl->events);
-                impl->events.clear();
+                add_statistic("inotify.buffer_bytes", shard.read_buffer.size() - buffer_size);
             }
+        }
+
+        return read_count > 0;
+    }
 
-            sleep(latency);
+    void Inotify_monitor::run_shard(inotify_shard &shard, bool scan_roots)
+    {
+        /*
+         * The latency is the period of the housekeeping tick, used to rescan the
+         * root paths that could not be watched yet: events are delivered as soon
+         * as they are read.  If a batch window is configured, events read within
+         * the window following the first one are delivered in a single batch.
+         */
+        const int latency_ms = std::max(1, static_cast<int>(this->latency * 1000));
+        const long long batch_window_ms = get_numeric_property("inotify.batch_window_ms", 0);
+
+        for(;;)
+        {
+            if (should_stop) break;
+
+            process_pending_events(shard);
+
+            if (scan_roots) scan_root_paths();
+
+            /* Deliver the creation of the entries found in new directories. */
+            if (shard.events.size())
+            {
+                notify_events(shard.events);
+                shard.events.clear();
+            }
+
+            if (wait_for_events(shard, latency_ms) <= 0) continue;
+
+            if (!drain_events(shard)) continue;
+
+            if (batch_window_ms > 0)
+            {
+                auto deadline = std::chrono::steady_clock::now() +
+                                std::chrono::milliseconds(batch_window_ms);
+
+                for (;;)
+                {
+                    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            deadline - std::chrono::steady_clock::now()).count();
+                    if (remaining <= 0 || should_stop) break;
+
+                    if (wait_for_events(shard, static_cast<int>(remaining)) > 0)
+                    {
+                        drain_events(shard);
+                    }
+                }
+            }
+
+            if (shard.events.size())
+            {
+                notify_events(shard.events);
+                shard.events.clear();
+            }
+        }
+    }
+
+    void Inotify_monitor::configure()
+    {
+        const long long shard_count = get_numeric_property("inotify.shards", 1);
+
+        if (shard_count < 1) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property inotify.shards: %lld",
+                                                                shard_count),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        /*
+         * Shards are created when the monitor is first started: watches are
+         * assigned to a shard by a hash of their top directory, which the
+         * number of shards must not change afterwards.
+         */
+        if (impl->shards.size() == 1 && impl->shards[0]->watches.size() == 0) {
+            while (impl->shards.size() < static_cast<size_t>(shard_count)) impl->shards.push_back(create_shard());
         }
+
+        set_statistic("inotify.shards", impl->shards.size());
+    }
+
+    void Inotify_monitor::run()
+    {
+
+        impl->crawler.reset(new Directory_crawler(
+                static_cast<unsigned int>(get_numeric_property("scan.threads", 1)),
+                follow_symlinks,
+                &should_stop));
+
+        /* Only directories are watched below the root paths. */
+        impl->crawler->set_visit_files(false);
+
+        /*
+         * A directory reached through a second path would have its watch moved
+         * to that path: it is only crawled once.
+         */
+        impl->crawler->set_unique_directories(true);
+
+        /* Filtered entries are pruned before they are stat'ed. */
+        crawler_filter entry_filter = [this] (const std::string &path, bool is_dir) {
+            return accept_path(path, is_dir);
+        };
+        impl->crawler->set_filter(entry_filter);
+
+        for (auto &shard : impl->shards) {
+            shard->new_directory_crawler.reset(new Directory_crawler(1, follow_symlinks, &should_stop));
+            shard->new_directory_crawler->set_filter(entry_filter);
+            shard->new_directory_crawler->set_unique_directories(true);
+        }
+
+        impl->watch_mask = get_watch_mask();
+        set_statistic("inotify.watch_mask", impl->watch_mask);
+
+        if (impl->shards.size() == 1) {
+            run_shard(*impl->shards[0], true);
+            return;
+        }
+
+        /*
+         * Each shard is drained by its own thread, and the shards merge their
+         * events through notify_events(), which serializes them.  A failing
+         * shard stops the monitor: its error is rethrown once every shard
+         * thread has returned.
+         */
+        for (size_t i = 1; i < impl->shards.size(); ++i) {
+            inotify_shard &shard = *impl->shards[i];
+
+            shard.thread = std::thread([this, &shard] {
+                try {
+                    run_shard(shard, false);
+                } catch (...) {
+                    {
+                        std::lock_guard<std::mutex> error_guard(impl->shard_error_mutex);
+                        if (!impl->shard_error) impl->shard_error = std::current_exception();
+                    }
+                    stop();
+                }
+            });
+        }
+
+        std::exception_ptr error;
+
+        try {
+            run_shard(*impl->shards[0], true);
+        } catch (...) {
+            error = std::current_exception();
+            stop();
+        }
+
+        for (size_t i = 1; i < impl->shards.size(); ++i) impl->shards[i]->thread.join();
+
+        if (!error) {
+            std::lock_guard<std::mutex> error_guard(impl->shard_error_mutex);
+            std::swap(error, impl->shard_error);
+        }
+
+        if (error) std::rethrow_exception(error);
     }
 }
@@ -5,11 +5,13 @@
 #include <sys/inotify.h>
 #include <string>
 #include <vector>
+#include <memory>
 #include <sys/stat.h>
 #include "monitor.h"
 
 namespace fm {
     struct inotify_monitor_impl;
+    struct inotify_shard;
 
     class Inotify_monitor : public Monitor {
     public:
@@ -19,22 +21,90 @@ namespace fm {
         virtual ~Inotify_monitor();
 
     protected:
+        void configure();
         void run();
 
     private:
         Inotify_monitor(const Inotify_monitor &orig) = delete;
         Inotify_monitor &operator=(const Inotify_monitor &that) = delete;
 
+        /*
+         * Creates an inotify instance and the epoll set its thread waits on.
+         * */
+        std::unique_ptr<inotify_shard> create_shard();
+
+        /*
+         * Returns the shard watching @p path: the watches of the directories
+         * below a root path are partitioned by their top directory.  A
+         * directory moved below another top directory may change shard.
+         * */
+        inotify_shard &get_shard(const std::string &path) const;
+
+        /*
+         * Reads the events of @p shard and delivers them until the monitor is
+         * stopped.  The root paths are scanned by the loop of the first shard.
+         * */
+        void run_shard(inotify_shard &shard, bool scan_roots);
         void scan_root_paths();
         bool is_watched(const std::string &path) const;
-        void preprocess_dir_event(struct inotify_event *event);
-        void preprocess_event(struct inotify_event *event);
-        void preprocess_node_event(struct inotify_event *event);
-        void scan(const std::string &path, const bool accept_non_dirs = true);
-        bool add_watch(const std::string &path,
-                      const struct stat &fd_stat);
-        void process_pending_events();
-        void remove_watch(int fd);
+        void preprocess_dir_event(inotify_shard &shard, struct inotify_event *event);
+        void preprocess_event(inotify_shard &shard, struct inotify_event *event);
+        void preprocess_node_event(inotify_shard &shard, struct inotify_event *event);
+
+        /*
+         * Matches the half of a directory move read by @p shard with the other
+         * half, read by any shard.  If the directory changed shard, the
+         * watches of its subdirectories are queued for removal from its former
+         * shard, which would otherwise report their events under their old
+         * paths as well.
+         * */
+        void match_directory_move(inotify_shard &shard,
+                                  const struct inotify_event *event,
+                                  const std::string &path);
+
+        /*
+         * Removes the watches below @p path from the shard owning it.
+         * */
+        void remove_moved_watches(const std::string &path);
+
+        /*
+         * Watches @p path and, if the monitor is recursive, its subdirectories
+         * that are not watched yet.  If @p report_created is set, a Created
+         * event is reported by @p reporter, whose thread scans, for each entry
+         * found below @p path.  It returns the number of nodes visited by the
+         * crawler.
+         * */
+        unsigned long long scan(const std::string &path,
+                                const bool accept_non_dirs = true,
+                                inotify_shard *reporter = nullptr);
+        /*
+         * Returns the smallest inotify event mask providing the events that are
+         * accepted by the event type filters and required to keep the watches
+         * up to date.
+         * */
+        uint32_t get_watch_mask() const;
+
+        /*
+         * Adds the watch of @p path to @p shard, whose watch mutex must be
+         * held.
+         * */
+        bool add_watch(inotify_shard &shard,
+                       const std::string &path,
+                       const struct stat &fd_stat);
+        void process_pending_events(inotify_shard &shard);
+
+        /*
+         * Waits until the inotify descriptor of @p shard is readable, the
+         * monitor is woken up or @p timeout_ms elapses.  Returns 1 if events can
+         * be read, 0 otherwise.
+         * */
+        int wait_for_events(inotify_shard &shard, int timeout_ms);
+
+        /*
+         * Reads and preprocesses the queued events of @p shard until its
+         * inotify queue is empty.  Returns true if any event was read.
+         * */
+        bool drain_events(inotify_shard &shard);
 
         inotify_monitor_impl *impl;
     };
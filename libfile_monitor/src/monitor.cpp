@@ -3,6 +3,18 @@
 #include <utility>
 #include <chrono>
 #include <regex>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "config.h"
+#if defined(HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#endif
 #include "monitor.h"
 #include "exception.h"
 #include "string_utils.h"
@@ -27,6 +39,24 @@ namespace fm {
         milliseconds epoch = duration_cast<milliseconds>
                                           (system_clock::now().time_since_epoch());
         last_notification.store(epoch);
+
+#if defined(HAVE_SYS_EVENTFD_H)
+        wakeup_fds[0] = wakeup_fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeup_fds[0] == -1) {
+            perror("eventfd");
+            throw fm_exception(string("Cannot create the monitor wakeup channel."));
+        }
+#else
+        if (pipe(wakeup_fds) == -1) {
+            perror("pipe");
+            throw fm_exception(string("Cannot create the monitor wakeup channel."));
+        }
+
+        for (int fd : wakeup_fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
     }
 
     void Monitor::set_allow_overflow(bool overflow) {
@@ -57,28 +87,38 @@ namespace fm {
     }
 
     void Monitor::add_event_type_filter(const EVENT_TYPE_FILTER &filter) {
+        if (event_type_filters.empty()) {
+            accepted_event_types = NoOp;
+            accept_no_op = false;
+        }
+
         this->event_type_filters.push_back(filter);
+
+        if (filter.flag == NoOp) accept_no_op = true;
+        accepted_event_types |= filter.flag;
     }
 
     void Monitor::set_event_type_filters(const std::vector<EVENT_TYPE_FILTER> &filters) {
         event_type_filters.clear();
+        accepted_event_types = ~NoOp;
+        accept_no_op = true;
         for (const auto &filter : filters) {
             add_event_type_filter(filter);
         }
     }
 
     void Monitor::add_filter(const Monitor_filter &filter) {
-        std::regex::flag_type regex_flags = std::regex::basic;
-
-        if (filter.extended) {
-            regex_flags = std::regex::extended;
-        }
-        if (!filter.case_sensitive) {
-            regex_flags |= std::regex::icase;
+        if (filter.glob) {
+            ignore_rules.add_rule("", filter.text, filter.case_sensitive,
+                                  filter.type == fm_filter_type::filter_include);
+            filter_cache.clear();
+            return;
         }
 
+        filter_cache.clear();
+
         try {
-            this->filters.push_back({std::regex(filter.text, regex_flags), filter.type});
+            this->filters.add(filter);
         } catch (std::regex_error &error) {
             throw fm_exception(string_utils::string_from_format("An error occurred during the compilation of %s",
                                                                 filter.text.c_str(),
@@ -86,6 +126,77 @@ namespace fm {
         }
     }
 
+    fm_subscription_id Monitor::subscribe(const std::vector<Monitor_filter> &filters,
+                                          const std::vector<EVENT_TYPE_FILTER> &event_types,
+                                          FM_EVENT_CALLBACK *callback,
+                                          void *context) {
+        if (callback == nullptr) {
+            throw fm_exception("Callback cannot be null.", FM_ERR_CALLBACK_NOT_SET);
+        }
+
+        return add_subscription(filters, event_types, [callback, context] (const Event_batch &batch) {
+            std::vector<Event> events;
+            batch.to_events(events);
+            callback(events, context);
+        });
+    }
+
+    fm_subscription_id Monitor::subscribe(const std::vector<Monitor_filter> &filters,
+                                          const std::vector<EVENT_TYPE_FILTER> &event_types,
+                                          FM_EVENT_BATCH_CALLBACK *callback,
+                                          void *context) {
+        if (callback == nullptr) {
+            throw fm_exception("Callback cannot be null.", FM_ERR_CALLBACK_NOT_SET);
+        }
+
+        return add_subscription(filters, event_types, [callback, context] (const Event_batch &batch) {
+            callback(batch, context);
+        });
+    }
+
+    fm_subscription_id Monitor::add_subscription(const std::vector<Monitor_filter> &filters,
+                                                 const std::vector<EVENT_TYPE_FILTER> &event_types,
+                                                 Subscription_set::delivery_function deliver) {
+        std::lock_guard<std::mutex> subscriptions_guard(subscriptions_mutex);
+
+        std::vector<Subscription_set::subscription> updated;
+        if (subscriptions) updated = subscriptions->get_subscriptions();
+
+        fm_subscription_id id = next_subscription_id++;
+        updated.push_back({id, filters, event_types, std::move(deliver)});
+
+        try {
+            std::atomic_store(&subscriptions,
+                              std::shared_ptr<const Subscription_set>(new Subscription_set(std::move(updated))));
+        } catch (std::regex_error &error) {
+            throw fm_exception("An error occurred during the compilation of a subscription filter.",
+                               FM_ERR_INVALID_REGEX);
+        }
+
+        return id;
+    }
+
+    bool Monitor::unsubscribe(fm_subscription_id id) {
+        std::lock_guard<std::mutex> subscriptions_guard(subscriptions_mutex);
+
+        if (!subscriptions) return false;
+
+        std::vector<Subscription_set::subscription> updated;
+
+        for (const Subscription_set::subscription &current : subscriptions->get_subscriptions()) {
+            if (current.id != id) updated.push_back(current);
+        }
+
+        if (updated.size() == subscriptions->size()) return false;
+
+        std::shared_ptr<const Subscription_set> replacement;
+        if (!updated.empty()) replacement.reset(new Subscription_set(std::move(updated)));
+
+        std::atomic_store(&subscriptions, replacement);
+
+        return true;
+    }
+
     void Monitor::set_property(const std::string &name, const std::string &value) {
         properties[name] = value;
     }
@@ -98,6 +209,25 @@ namespace fm {
         return properties[name];
     }
 
+    long long Monitor::get_numeric_property(const std::string &name,
+                                            long long default_value) const {
+        auto property = properties.find(name);
+        if (property == properties.end() || property->second.empty()) return default_value;
+
+        char *end = nullptr;
+        errno = 0;
+        long long value = strtoll(property->second.c_str(), &end, 10);
+
+        if (errno != 0 || *end != '\0') {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property %s: %s",
+                                                                name.c_str(),
+                                                                property->second.c_str()),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        return value;
+    }
+
     void Monitor::set_filters(const std::vector <Monitor_filter> &filters) {
         for (const Monitor_filter &filter : filters) {
             add_filter(filter);
@@ -113,29 +243,116 @@ namespace fm {
     }
 
     bool Monitor::accept_event_type(fm::fm_event_flag event_type) const {
-        if (event_type_filters.empty())
-            return true;
+        if (event_type == NoOp) return accept_no_op;
 
-        for (const auto &filter : event_type_filters) {
-            if (filter.flag == event_type) {
-                return true;
-            }
+        return (accepted_event_types & event_type) != 0;
+    }
+
+    void Monitor::add_ignore_file(const std::string &path) {
+        size_t separator = path.rfind('/');
+        std::string base = (separator == std::string::npos) ? "" : path.substr(0, separator);
+
+        if (!ignore_rules.add_rules_from_file(path, base)) {
+            throw fm_exception(string("Cannot read the ignore file ") + path, FM_ERR_INVALID_PATH);
         }
-		return false;
+
+        filter_cache.clear();
     }
 
-    bool Monitor::accept_path(std::string path) const {
-        bool is_excluded = false;
+    void Monitor::set_ignore_file_name(const std::string &name) {
+        ignore_file_name = name;
+        filter_cache.clear();
+    }
 
-        for (const auto &filter : filters) {
-            if (std::regex_search(path, filter.regex)) {
-                if (filter.type == fm_filter_type::filter_include)
-                    return true;
-                is_excluded = (filter.type == fm_filter_type::filter_exclude);
+    void Monitor::load_ignore_file(const std::string &directory) {
+        if (ignore_file_name.empty()) return;
+
+        std::string path = directory + "/" + ignore_file_name;
+        std::lock_guard<std::mutex> ignore_guard(ignore_mutex);
+
+        if (loaded_ignore_files.count(path)) return;
+        if (!ignore_rules.add_rules_from_file(path, directory)) return;
+
+        loaded_ignore_files.insert(path);
+        filter_cache.clear();
+    }
+
+    bool Monitor::accept_path(const std::string &path, bool is_dir) const {
+        return accept_path(path.data(), path.size(), is_dir);
+    }
+
+    fm_subtree_verdict Monitor::get_subtree_verdict(const char *directory, size_t length) const {
+        fm_subtree_verdict verdict;
+
+        if (filter_cache.lookup(directory, length, verdict)) return verdict;
+
+        /* A definitive verdict of an ancestor is inherited. */
+        verdict = subtree_undecided;
+
+        const char *separator = (length > 1) ? static_cast<const char *>(memrchr(directory, '/', length - 1))
+                                             : nullptr;
+        if (separator) {
+            size_t parent_length = (separator == directory) ? 1 : static_cast<size_t>(separator - directory);
+            verdict = get_subtree_verdict(directory, parent_length);
+        }
+
+        if (verdict == subtree_undecided) {
+            bool ignored;
+
+            if (!ignore_file_name.empty()) {
+                std::lock_guard<std::mutex> ignore_guard(ignore_mutex);
+                ignored = ignore_rules.is_ignored(directory, length, true);
+            } else {
+                ignored = ignore_rules.is_ignored(directory, length, true);
+            }
+
+            if (ignored) {
+                verdict = subtree_rejected;
+            } else {
+                verdict = filters.decide_subtree(directory, length);
+
+                /* Ignore rules may still exclude the paths that the filters accept. */
+                if (verdict == subtree_accepted && (!ignore_rules.empty() || !ignore_file_name.empty())) {
+                    verdict = subtree_undecided;
+                }
             }
         }
 
-        return !is_excluded;
+        filter_cache.insert(directory, length, verdict);
+
+        return verdict;
+    }
+
+    bool Monitor::accept_path(const char *path, size_t length, bool is_dir) const {
+        /* The cache only pays off when some directories can be decided. */
+        if (filter_cache.is_enabled() &&
+            (filters.can_decide_subtrees() || !ignore_rules.empty() || !ignore_file_name.empty())) {
+            const char *separator = (length > 1) ? static_cast<const char *>(memrchr(path, '/', length - 1))
+                                                 : nullptr;
+
+            if (separator) {
+                size_t parent_length = (separator == path) ? 1 : static_cast<size_t>(separator - path);
+
+                switch (get_subtree_verdict(path, parent_length)) {
+                    case subtree_accepted:
+                        return true;
+                    case subtree_rejected:
+                        return false;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        /* Ignore files are loaded while other threads may be filtering. */
+        if (!ignore_file_name.empty()) {
+            std::lock_guard<std::mutex> ignore_guard(ignore_mutex);
+            if (ignore_rules.is_ignored(path, length, is_dir)) return false;
+        } else if (ignore_rules.is_ignored(path, length, is_dir)) {
+            return false;
+        }
+
+        return filters.accept(path, length);
     }
 
     void* Monitor::get_context() const {
@@ -146,8 +363,56 @@ namespace fm {
         this->context = context;
     }
 
+    void Monitor::set_batch_callback(FM_EVENT_BATCH_CALLBACK *batch_callback) {
+        this->batch_callback = batch_callback;
+    }
+
     Monitor::~Monitor() {
         stop();
+
+        close(wakeup_fds[0]);
+        if (wakeup_fds[1] != wakeup_fds[0]) close(wakeup_fds[1]);
+    }
+
+    int Monitor::get_wakeup_fd() const {
+        return wakeup_fds[0];
+    }
+
+    void Monitor::wakeup() {
+#if defined(HAVE_SYS_EVENTFD_H)
+        uint64_t one = 1;
+        ssize_t written = write(wakeup_fds[1], &one, sizeof(one));
+#else
+        char one = 1;
+        ssize_t written = write(wakeup_fds[1], &one, sizeof(one));
+#endif
+        /* A full channel is already readable. */
+        (void) written;
+    }
+
+    void Monitor::reset_wakeup() {
+        char buffer[64];
+        while (read(wakeup_fds[0], buffer, sizeof(buffer)) > 0);
+    }
+
+    bool Monitor::wait_for_stop(milliseconds timeout) const {
+        struct pollfd wakeup_poll = {};
+        wakeup_poll.fd = wakeup_fds[0];
+        wakeup_poll.events = POLLIN;
+
+        auto deadline = steady_clock::now() + timeout;
+
+        while (!should_stop) {
+            auto remaining = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+            if (remaining <= 0) break;
+
+            if (poll(&wakeup_poll, 1, static_cast<int>(remaining)) == -1 && errno != EINTR) {
+                perror("poll()");
+                break;
+            }
+        }
+
+        return should_stop;
     }
 
     void Monitor::inactivity_callback(Monitor *montor) {
@@ -155,78 +420,300 @@ namespace fm {
             throw fm_exception(std::string("Callback argument cannot be null."));
         }
 
-        for (;;) {
-            std::unique_lock<std::mutex> run_guard(montor->run_mutex);
-            if (montor->should_stop) break;
-            run_guard.unlock();
+        try {
+            for (;;) {
+                if (montor->should_stop) break;
+
+                milliseconds elapsed = duration_cast<milliseconds>(system_clock::now().time_since_epoch()) -
+                        montor->last_notification.load();
 
-            milliseconds elapsed = duration_cast<milliseconds>(system_clock::now().time_since_epoch()) -
-                    montor->last_notification.load();
+                /* Sleep and loop again if sufficient time has not elapsed yet */
+                if (elapsed < montor->get_latency_ms()) {
+                    if (montor->wait_for_stop(montor->get_latency_ms() - elapsed)) break;
+                    continue;
+                }
 
-            /* Sleep and loop again if sufficient time has not elapsed yet */
-            if (elapsed < montor->get_latency_ms()) {
-                milliseconds to_sleep = montor->get_latency_ms() - elapsed;
-                seconds max_sleep_time(2);
+                /* build a fake event */
+                time_t curr_time;
+                time(&curr_time);
 
-                std::this_thread::sleep_for(to_sleep>max_sleep_time?max_sleep_time:to_sleep);
-                continue;
+                std::vector<Event> events;
+                events.emplace_back("", curr_time, fm_event_mask(NoOp));
+
+                montor->notify_events(events);
             }
+        }
+        catch (...) {
+            montor->set_thread_error(std::current_exception());
+        }
+    }
 
-            /* build a fake event */
-            time_t curr_time;
-            time(&curr_time);
+    void Monitor::coalescing_callback(Monitor *monitor) {
+        Event_batch batch;
 
-            std::vector<Event> events;
-            events.push_back({"", curr_time, {NoOp}});
+        try {
+            while (monitor->coalescer.wait_for_due_events(batch, monitor->should_stop)) {
+                std::unique_lock<std::mutex> notify_guard(monitor->notify_mutex);
+                monitor->deliver_events(batch);
+                notify_guard.unlock();
+
+                batch.clear();
+            }
+        }
+        catch (...) {
+            monitor->set_thread_error(std::current_exception());
+        }
+    }
+
+    void Monitor::set_thread_error(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> error_guard(thread_error_mutex);
+            if (!thread_error) thread_error = error;
+        }
+
+        stop();
+    }
+
+    void Monitor::start_dispatcher() {
+        const std::string mode = get_property("dispatch.mode");
+        const long long worker_count = get_numeric_property("dispatch.workers", 1);
+
+        if (worker_count <= 0 || (worker_count > 1 && mode == "sync")) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property dispatch.workers: %lld",
+                                                                worker_count),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        /* Several workers imply the asynchronous dispatch. */
+        if (mode == "sync" || (mode.empty() && worker_count == 1)) return;
+
+        if (!mode.empty() && mode != "async") {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property dispatch.mode: %s",
+                                                                mode.c_str()),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        fm_backpressure_policy policy = backpressure_block;
+        const std::string backpressure = get_property("dispatch.backpressure");
+
+        if (!backpressure.empty() && !Event_dispatcher::parse_policy(backpressure, policy)) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property dispatch.backpressure: %s",
+                                                                backpressure.c_str()),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        const long long queue_size = get_numeric_property("dispatch.queue_size", Event_dispatcher::DEFAULT_QUEUE_SIZE);
+
+        if (queue_size <= 0) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property dispatch.queue_size: %lld",
+                                                                queue_size),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        Event_dispatcher::partition_function partition;
+        const std::string partition_name = get_property("dispatch.partition");
+
+        if (partition_name == "top-directory") {
+            partition = [this] (const char *path, size_t length) {
+                return get_top_directory_length(path, length);
+            };
+        } else if (!partition_name.empty() && partition_name != "path") {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property dispatch.partition: %s",
+                                                                partition_name.c_str()),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        dispatcher.start(static_cast<size_t>(queue_size),
+                         policy,
+                         static_cast<unsigned int>(worker_count),
+                         [this] (Event_batch &batch) { invoke_callback(batch); },
+                         partition,
+                         [this] { stop(); });
+    }
+
+    size_t Monitor::get_top_directory_length(const char *path, size_t length) const {
+        for (const std::string &root : paths) {
+            size_t root_length = root.size();
 
-            montor->notify_events(events);
+            /* A root path may be spelled with a trailing slash. */
+            while (root_length > 1 && root[root_length - 1] == '/') --root_length;
+
+            if (length <= root_length || memcmp(path, root.data(), root_length) != 0) continue;
+
+            const bool root_is_directory = (root[root_length - 1] == '/');
+            if (!root_is_directory && path[root_length] != '/') continue;
+
+            const char *start = path + root_length + (root_is_directory ? 0 : 1);
+            const char *separator = static_cast<const char *>(memchr(start, '/', path + length - start));
+
+            return separator ? static_cast<size_t>(separator - path) : length;
         }
+
+        return length;
     }
 
     void Monitor::start() {
         FM_MONITOR_RUN_GUARD;
-        if (this->running) return;
-
-        this->running = true;
+        if (this->running.exchange(true)) return;
         FM_MONITOR_RUN_GUARD_UNLOCK;
 
-        std::unique_ptr<std::thread> inactivity_thread;
+        /*
+         * Stops the threads started below and marks the monitor as stopped on
+         * every exit path, including an exception thrown by run().
+         */
+        struct run_scope {
+            explicit run_scope(Monitor &monitor) : monitor(monitor) {}
+
+            ~run_scope() {
+                join_threads();
+                monitor.dispatcher.stop();
+
+                std::lock_guard<std::mutex> run_guard(monitor.run_mutex);
+                monitor.running = false;
+                monitor.reset_wakeup();
+                monitor.should_stop = false;
+            }
+
+            void join_threads() {
+                if (!inactivity_thread && !coalescing_thread) return;
+
+                monitor.should_stop = true;
+                monitor.wakeup();
+
+                if (inactivity_thread) inactivity_thread->join();
+                inactivity_thread.reset();
+
+                if (coalescing_thread) {
+                    monitor.coalescer.wake();
+                    coalescing_thread->join();
+                }
+                coalescing_thread.reset();
+            }
+
+            Monitor &monitor;
+            std::unique_ptr<std::thread> inactivity_thread;
+            std::unique_ptr<std::thread> coalescing_thread;
+        } scope(*this);
+
+        const long long filter_cache_size = get_numeric_property("filter.cache_size",
+                                                                 Filter_cache::DEFAULT_CAPACITY);
+        filter_cache.set_capacity(filter_cache_size > 0 ? static_cast<size_t>(filter_cache_size) : 0);
+
+        const long long coalesce_window_ms = get_numeric_property("coalesce.window_ms", 0);
+        coalescer.set_window(milliseconds(coalesce_window_ms),
+                             milliseconds(get_numeric_property("coalesce.max_delay_ms", 10 * coalesce_window_ms)));
+
+        {
+            std::lock_guard<std::mutex> error_guard(thread_error_mutex);
+            thread_error = nullptr;
+        }
+
+        configure();
+        start_dispatcher();
+
         if (fire_idle_event) {
-            inactivity_thread.reset(new std::thread(Monitor::inactivity_callback, this));
+            scope.inactivity_thread.reset(new std::thread(Monitor::inactivity_callback, this));
+        }
+
+        if (coalescer.is_enabled()) {
+            scope.coalescing_thread.reset(new std::thread(Monitor::coalescing_callback, this));
         }
 
         this->run();
 
-        if (inactivity_thread) inactivity_thread->join();
+        scope.join_threads();
 
-        FM_MONITOR_RUN_GUARD_LOCK;
-        this->running = false;
-        this->should_stop = false;
-        FM_MONITOR_RUN_GUARD_UNLOCK;
+        /* A callback that threw on the inactivity or the coalescing thread stopped the monitor. */
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> error_guard(thread_error_mutex);
+            error.swap(thread_error);
+        }
+        if (error) std::rethrow_exception(error);
+
+        /* Deliver the events still held back. */
+        if (coalescer.is_enabled()) {
+            Event_batch pending;
+            coalescer.flush(pending);
+
+            FM_MONITOR_NOTIFY_GUARD;
+            if (!pending.empty()) deliver_events(pending);
+        }
+
+        /* A callback that threw on a dispatcher thread stopped the monitor. */
+        dispatcher.stop();
+        dispatcher.rethrow_error();
     }
 
     void Monitor::stop() {
-        FM_MONITOR_RUN_GUARD;
-        if (!this->running || this->should_stop) return;
+        if (!this->running || this->should_stop.exchange(true)) return;
 
-        this->should_stop = true;
+        /*
+         * The coalescing thread is woken up by start() once run() returns:
+         * waking it up here would take its lock.
+         */
+        wakeup();
         on_stop();
     }
 
     bool Monitor::is_running() {
-        FM_MONITOR_RUN_GUARD;
         return this->running;
     }
 
-    std::vector<fm_event_flag> Monitor::filter_flags(const Event &evt) const {
-        if (event_type_filters.empty()) return evt.get_flags();
+    std::map<std::string, unsigned long long> Monitor::get_statistics() const {
+        std::map<std::string, unsigned long long> result;
+
+        {
+            std::lock_guard<std::mutex> statistics_guard(statistics_mutex);
+            result = statistics;
+        }
+
+        if (coalescer.is_enabled()) {
+            result["coalesce.raw_events"] = coalescer.get_raw_events();
+            result["coalesce.merged_events"] = coalescer.get_merged_events();
+            result["coalesce.cancelled_events"] = coalescer.get_cancelled_events();
+            result["coalesce.pending_events"] = coalescer.size();
+        }
 
-        std::vector<fm_event_flag> filtered_flags;
+        if (dispatcher.is_enabled()) {
+            result["dispatch.batches"] = dispatcher.get_dispatched_batches();
+            result["dispatch.blocked_pushes"] = dispatcher.get_blocked_pushes();
+            result["dispatch.dropped_batches"] = dispatcher.get_dropped_batches();
+            result["dispatch.dropped_events"] = dispatcher.get_dropped_events();
+            result["dispatch.coalesced_events"] = dispatcher.get_coalesced_events();
+            result["dispatch.max_queue_depth"] = dispatcher.get_max_queue_depth();
+        }
+
+        std::shared_ptr<const Subscription_set> current = std::atomic_load(&subscriptions);
+        if (current) result["subscriptions"] = current->size();
 
-        for (auto const &flag : evt.get_flags()) {
-            if (accept_event_type(flag)) filtered_flags.push_back(flag);
+        if (filter_cache.is_enabled()) {
+            result["filter.cache_entries"] = filter_cache.size();
+            result["filter.cache_hits"] = filter_cache.get_hits();
+            result["filter.cache_misses"] = filter_cache.get_misses();
         }
-        return filtered_flags;
+
+        return result;
+    }
+
+    void Monitor::set_statistic(const std::string &name, unsigned long long value) {
+        std::lock_guard<std::mutex> statistics_guard(statistics_mutex);
+        statistics[name] = value;
+    }
+
+    void Monitor::add_statistic(const std::string &name, unsigned long long delta) {
+        std::lock_guard<std::mutex> statistics_guard(statistics_mutex);
+        statistics[name] += delta;
+    }
+
+    void Monitor::max_statistic(const std::string &name, unsigned long long value) {
+        std::lock_guard<std::mutex> statistics_guard(statistics_mutex);
+        unsigned long long &current = statistics[name];
+        if (value > current) current = value;
+    }
+
+    fm_event_mask Monitor::filter_flags(const Event &evt) const {
+        return evt.get_mask() & accepted_event_types;
     }
 
     void Monitor::notify_overflow(const std::string &path) const {
@@ -235,31 +722,71 @@ namespace fm {
         time_t curr_time;
         time(&curr_time);
 
-        notify_events({{path, curr_time, {fm_event_flag::Overflow}}});
+        notify_events({{path, curr_time, fm_event_mask(fm_event_flag::Overflow)}});
     }
 
     void Monitor::notify_events(const std::vector<Event> &events) const {
+        Event_batch batch;
+
+        for (const Event &event : events) batch.add(event);
+
+        notify_events(batch);
+    }
+
+    void Monitor::notify_events(Event_batch &batch) const {
         FM_MONITOR_NOTIFY_GUARD;
 
         milliseconds now = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
         last_notification.store(now);
 
-        std::vector<Event> filtered_event;
+        batch.remove_if([this] (Event_batch &events, size_t i) {
+            fm_event_mask flags = events.get_mask(i);
 
-        for (auto const &event : events) {
-            std::vector<fm_event_flag> filtered_flags = filter_flags(event);
+            /* Idle events have no flags and are only filtered by type. */
+            if (flags == NoOp) return !accept_no_op;
 
-            if (filtered_flags.empty()) continue;
-            if (!accept_path(event.get_path())) continue;
+            /* The node type does not depend on the event types being accepted. */
+            const bool is_dir = (flags & IsDir) != 0;
+            flags &= accepted_event_types;
 
-            filtered_event.emplace_back(event.get_path(),
-                                        event.get_time(),
-                                        filtered_flags);
+            if (flags == NoOp) return true;
+            if (!accept_path(events.get_path(i), events.get_path_length(i), is_dir)) return true;
+
+            events.set_mask(i, flags);
+            return false;
+        });
+
+        /* Coalesced events are delivered by the coalescing thread. */
+        if (coalescer.is_enabled()) coalescer.add(batch);
+
+        if (batch.empty()) return;
+
+        deliver_events(batch);
+    }
+
+    void Monitor::deliver_events(Event_batch &batch) const {
+        if (dispatcher.is_running()) {
+            dispatcher.push(batch);
+            return;
         }
 
-        if (!filtered_event.empty()) {
-            callback(filtered_event, context);
+        invoke_callback(batch);
+    }
+
+    void Monitor::invoke_callback(const Event_batch &batch) const {
+        if (batch_callback) {
+            batch_callback(batch, context);
+        } else {
+            std::vector<Event> events;
+            batch.to_events(events);
+            callback(events, context);
         }
+
+        std::shared_ptr<const Subscription_set> current = std::atomic_load(&subscriptions);
+        if (current) current->deliver(batch);
+    }
+
+    void Monitor::configure() {
     }
 
     void Monitor::on_stop() {
@@ -11,20 +11,25 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <set>
 #include <atomic>
+#include <exception>
 #include <chrono>
 #include <regex>
 #include <mutex>
 #include "event.h"
+#include "event_batch.h"
 #include "filter.h"
+#include "path_filter.h"
+#include "glob_filter.h"
+#include "filter_cache.h"
+#include "event_coalescer.h"
+#include "event_dispatcher.h"
+#include "subscription_set.h"
 
 namespace fm{
 
-    typedef struct _compiled_monitor_filter {
-        std::regex regex;
-        fm_filter_type type;
-    }COMPILED_MONITOR_FILTER_S;
-
     /*
      * This enumeration lists all the available monitors, you can
      * add the platform-specific default monitor.
@@ -34,6 +39,7 @@ namespace fm{
         system_default_monitor_type = 0, /*System default monitor. */
         inotify_monitor_type,            /*Linux `inotify` monitor. */
         poll_monitor_type,               /* `stat()`-based poll monitor. */
+        uring_poll_monitor_type,         /* Poll monitor submitting `statx` requests through io_uring. */
     };
 
     /*
@@ -47,6 +53,14 @@ namespace fm{
      * */
     typedef void FM_EVENT_CALLBACK(const std::vector<Event>&, void *);
 
+    /*
+     * @brief Function definition of an event batch callback.
+     * The batch callback receives the events as a fm::Event_batch, whose
+     * storage is reused by the monitor: no fm::Event objects are built.  The
+     * batch is only valid during the call.
+     * */
+    typedef void FM_EVENT_BATCH_CALLBACK(const Event_batch&, void *);
+
     /*
      * @brief Base class of all monitors.
      *
@@ -60,6 +74,8 @@ namespace fm{
      * At least the following tasks must be performed to implement a monitor:
      *
      *    - Providing an implementation of the run() method.
+     *    - Providing an implementation of the configure() method if the
+     *      monitor reads its own properties.
      *    - Providing an implementation of the on_stop() method if the
      *      monitor cannot be stopped cooperatively from the run() method.
      *
@@ -72,12 +88,10 @@ namespace fm{
      *
      *       for (;;)
      *       {
-     *           unique_lock<mutex> run_guard(run_mutex);
-     *           if (should_stop) break;
-     *           run_guard.unlock();
+     *         if (should_stop) break;
      *
      *         scan_paths();
-     *         wait_for_events();
+     *         wait_for_events(get_wakeup_fd());
      *
      *         vector<change_events> evts = get_changes();
      *         vector<event> events;
@@ -103,9 +117,11 @@ namespace fm{
      *
      *   - It enters a loop, often infinite, where change events are waited for.
      *
-     *   - Tt locks on monitor::run_mutex to check whether monitor::should_stop
-     *     is set to true.  If it is, the monitor breaks the loop to return from
-     *     run() as soon as possible.
+     *   - It checks whether the atomic monitor::should_stop flag is set to true.
+     *     If it is, the monitor breaks the loop to return from run() as soon as
+     *     possible.  Blocking waits should include the descriptor returned by
+     *     get_wakeup_fd(), which becomes readable when stop() is called, so that
+     *     the monitor stops immediately regardless of its latency.
      *
      *   - It scans the paths that must be observed: this step might be necessary
      *     for example because some path may not have existed during the previous
@@ -156,38 +172,102 @@ namespace fm{
         void *get_context() const;
         void set_context(void *context);
 
+        /*
+         * If a batch callback is set, it is invoked instead of the event
+         * callback passed to the constructor.
+         * */
+        void set_batch_callback(FM_EVENT_BATCH_CALLBACK *batch_callback);
+
         void add_filter(const Monitor_filter &filter);
         void set_filters(const std::vector<Monitor_filter> &filters);
 
+        /*
+         * Adds the rules of the ignore file @p path, in gitignore syntax.  The
+         * rules apply below the directory of @p path, which must be spelled as
+         * the observed paths are (absolute or relative).
+         * */
+        void add_ignore_file(const std::string &path);
+
+        /*
+         * Sets the name of the ignore files, such as `.gitignore`, that are
+         * looked for in the directories being scanned.  The rules of the ignore
+         * file of a directory apply below it and are loaded before its children
+         * are scanned, so that ignored subtrees are never watched nor stat'ed.
+         * An ignore file is read once, when it is first found.
+         * */
+        void set_ignore_file_name(const std::string &name);
+
         void add_event_type_filter(const EVENT_TYPE_FILTER &filter);
         void set_event_type_filters(
                 const std::vector<EVENT_TYPE_FILTER>& filters);
 
+        /*
+         * Registers a callback receiving the events that pass both the filters
+         * of the monitor and @p filters and @p event_types, which are evaluated
+         * in a single pass for all the subscriptions.  The filters of the
+         * monitor decide what is watched: subscriptions share its watches and
+         * only narrow the events they receive.  The callback passed to the
+         * constructor still receives all the events.
+         *
+         * Subscriptions may be added and removed while the monitor is running.
+         * An exception is thrown if a regular expression is not valid.
+         * */
+        fm_subscription_id subscribe(const std::vector<Monitor_filter> &filters,
+                                     const std::vector<EVENT_TYPE_FILTER> &event_types,
+                                     FM_EVENT_CALLBACK *callback,
+                                     void *context = nullptr);
+        fm_subscription_id subscribe(const std::vector<Monitor_filter> &filters,
+                                     const std::vector<EVENT_TYPE_FILTER> &event_types,
+                                     FM_EVENT_BATCH_CALLBACK *callback,
+                                     void *context = nullptr);
+
+        /*
+         * Removes the subscription @p id.  Deliveries already in progress may
+         * still invoke its callback.  It returns false if @p id is unknown.
+         * */
+        bool unsubscribe(fm_subscription_id id);
+
         /*
          * The monitor status is marked running and it starts watching for
          * change events. This function performs the following tasks:
          *
-         *    - Atomically marks the thread state as running, locking on
-         *      Monitor::run_mutex.
-         *    - Calls the run() function: the Monitor::run_mutex is not locked
-         *      during this call.
+         *    - Atomically marks the thread state as running.
+         *    - Reads the properties and calls the configure() function, before
+         *      any thread is started.
+         *    - Calls the run() function.
          *    - When run() returns, it atomically marks the thread state as
-         *      stopped, locking on Monitor::run_mutex.
+         *      stopped and resets the wakeup channel.
          *
          * This call does _not_ return until the monitor is stopped and events are
-         * notified from its thread.
+         * notified from its thread.  If a property is invalid or run() throws,
+         * the threads started by start() are stopped, the monitor is marked as
+         * stopped, so that it can be started again, and the exception is
+         * rethrown.  A callback throwing on a dispatcher, coalescing or
+         * inactivity thread stops the monitor, and its exception is rethrown
+         * the same way.
          * */
         void start();
 
         /*
          * stop() is designed to be called from another thread.
          * stop() is a cooperative signal that must be handled in an
-         * implementation-specific way in the run() function.
+         * implementation-specific way in the run() function: it sets the
+         * Monitor::should_stop flag and makes the wakeup channel readable.
+         *
+         * stop() does not lock and is safe to call from a signal handler as
+         * long as the on_stop() implementation is.
          * */
         void stop();
 
         bool is_running();
 
+        /*
+         * This function returns a snapshot of the counters published by the
+         * monitor implementation, such as the sizes of the reads performed by
+         * the inotify monitor.
+         * */
+        std::map<std::string, unsigned long long> get_statistics() const;
+
         /*
          * Monitor file access events.
          * */
@@ -195,15 +275,56 @@ namespace fm{
 
     protected:
         bool accept_event_type(enum fm_event_flag event_type) const;
-        bool accept_path(std::string path) const;
+        /*
+         * Returns true if @p path passes the path filters and is not ignored.
+         * @p is_dir tells whether @p path is a directory, which matters to the
+         * ignore rules restricted to directories.
+         * */
+        bool accept_path(const std::string &path, bool is_dir = false) const;
+        bool accept_path(const char *path, size_t length, bool is_dir = false) const;
+
+        /*
+         * Loads the ignore file found in @p directory, if ignore files are
+         * enabled and it has not been loaded yet.  Monitors call it for each
+         * directory they scan, before scanning its children.
+         * */
+        void load_ignore_file(const std::string &directory);
         void notify_events(const std::vector<Event>& events) const;
+
+        /*
+         * Filters @p batch in place and notifies the remaining events.
+         * */
+        void notify_events(Event_batch& batch) const;
         void notify_overflow(const std::string& path) const;
 
         /*
          * This function filters the event types of an event leaving only the types
-         * allowed by the configured filters.
+         * allowed by the configured filters.  NoOp is returned if none is left.
+         * */
+        fm_event_mask filter_flags(const Event& evt) const;
+
+        /*
+         * This function returns the numeric value of the property @p name, or
+         * @p default_value if the property has not been set.  An exception is
+         * thrown if the property is set to a value that is not a number.
+         * */
+        long long get_numeric_property(const std::string &name,
+                                       long long default_value) const;
+
+        /*
+         * Returns the length of the prefix of @p path ending with its first
+         * component below the root path containing it, or @p length if it is
+         * not below a root path.
          * */
-        std::vector<fm_event_flag> filter_flags(const Event& evt) const;
+        size_t get_top_directory_length(const char *path, size_t length) const;
+
+        /*
+         * These functions publish a counter returned by get_statistics():
+         * max_statistic() raises it to @p value if it is lower.
+         * */
+        void set_statistic(const std::string &name, unsigned long long value);
+        void add_statistic(const std::string &name, unsigned long long delta);
+        void max_statistic(const std::string &name, unsigned long long value);
 
         /*
          * This function implements the monitor event watching logic.  This function
@@ -212,10 +333,17 @@ namespace fm{
          * monitor is marked as stopped.
          *
          * This function should cooperatively check the Monitor::should_stop field
-         * locking monitor::run_mutex and return if set to true.
+         * and return if set to true.
          * */
         virtual void run() = 0;
 
+        /*
+         * This function reads the properties of the monitor implementation.  It
+         * is called from start() before run() and before any thread is started,
+         * and throws an fm_exception if a property is invalid.
+         * */
+        virtual void configure();
+
         /*
          * This function is executed by the stop() method, after requesting the
          * monitor to stop.  This handler is required if the thread running run() is
@@ -224,10 +352,26 @@ namespace fm{
          * */
         virtual void on_stop();
 
+        /*
+         * This function returns the read end of the monitor wakeup channel.  The
+         * descriptor becomes readable when stop() is called and stays readable
+         * until the monitor is stopped, so that run() can wait on it together
+         * with its own event sources.
+         * */
+        int get_wakeup_fd() const;
+
+        /*
+         * This function sleeps for @p timeout or until the monitor is requested
+         * to stop, whichever comes first.  It returns true if the monitor should
+         * stop.
+         * */
+        bool wait_for_stop(std::chrono::milliseconds timeout) const;
+
     protected:
         std::vector<std::string> paths;
         std::map<std::string, std::string> properties;
         FM_EVENT_CALLBACK *callback;
+        FM_EVENT_BATCH_CALLBACK *batch_callback = nullptr;
         void *context = nullptr;
         double latency = 1.0;
         bool fire_idle_event = false;
@@ -240,19 +384,74 @@ namespace fm{
         /*
          * Monitor state
          * */
-        bool running = false;
-        bool should_stop = false;
+        std::atomic<bool> running{false};
+        std::atomic<bool> should_stop{false};
 
         mutable std::mutex run_mutex;
         mutable std::mutex notify_mutex;
 
     private:
         std::chrono::milliseconds get_latency_ms() const;
-        std::vector<COMPILED_MONITOR_FILTER_S> filters;     // path filter
+
+        /*
+         * Returns the verdict shared by every path below @p directory, caching
+         * it with those of the ancestors of @p directory.
+         * */
+        fm_subtree_verdict get_subtree_verdict(const char *directory, size_t length) const;
+        Path_filter filters;                                // path filter
+        Glob_filter ignore_rules;                           // gitignore-style rules
+        std::string ignore_file_name;                       // per-directory ignore file
+        std::set<std::string> loaded_ignore_files;
+        mutable std::mutex ignore_mutex;                    // guards the ignore rules loaded while scanning
+        mutable Filter_cache filter_cache;                  // verdicts of the directories seen so far
+        mutable Event_coalescer coalescer;                  // events held back until their path is quiet
+        mutable Event_dispatcher dispatcher;                // callback thread of the asynchronous dispatch
+
+        /* Replaced, never modified, when subscriptions change. */
+        std::shared_ptr<const Subscription_set> subscriptions;
+        std::mutex subscriptions_mutex;                     // serializes the changes of the subscriptions
+        fm_subscription_id next_subscription_id = 1;
         std::vector<EVENT_TYPE_FILTER> event_type_filters;  // event type filter
+        fm_event_mask accepted_event_types = ~NoOp;          // union of the event type filters
+        bool accept_no_op = true;                            // NoOp is not a bit of the mask
 
         static void inactivity_callback(Monitor *montor);
+        static void coalescing_callback(Monitor *monitor);
+
+        /*
+         * Keeps the first exception thrown on the inactivity or the coalescing
+         * thread, typically by the callback, and stops the monitor.  start()
+         * rethrows it once the threads are joined.
+         * */
+        void set_thread_error(std::exception_ptr error);
+        std::exception_ptr thread_error;
+        std::mutex thread_error_mutex;
+
+        /*
+         * Hands the filtered events of @p batch to the dispatcher, or invokes
+         * the callback if dispatch is synchronous.  The caller must hold
+         * notify_mutex.
+         * */
+        void deliver_events(Event_batch &batch) const;
+        void invoke_callback(const Event_batch &batch) const;
+        void start_dispatcher();
+
+
+        fm_subscription_id add_subscription(const std::vector<Monitor_filter> &filters,
+                                            const std::vector<EVENT_TYPE_FILTER> &event_types,
+                                            Subscription_set::delivery_function deliver);
+        void wakeup();
+        void reset_wakeup();
+
+        /*
+         * Wakeup channel: an eventfd when available (both descriptors are the
+         * same), a non-blocking self-pipe otherwise.
+         * */
+        int wakeup_fds[2] = {-1, -1};
         mutable std::atomic<std::chrono::milliseconds> last_notification;
+
+        mutable std::mutex statistics_mutex;
+        std::map<std::string, unsigned long long> statistics;
     };
 }
 
@@ -10,6 +10,7 @@
 #include "inotify_monitor.h"
 #endif
 #include "poll_monitor.h"
+#include "uring_poll_monitor.h"
 
 namespace fm {
     static Monitor *create_default_monitor(std::vector<std::string> paths,
@@ -44,6 +45,8 @@ namespace fm {
 #endif
             case poll_monitor_type:
                 return new Poll_monitor(paths, callback, context);
+            case uring_poll_monitor_type:
+                return new Uring_poll_monitor(paths, callback, context);
             default:
                 throw fm_exception("Unsupported monitor.",
                                        FM_ERR_UNKNOWN_MONITOR_TYPE);
@@ -63,6 +66,8 @@ namespace fm {
         creator_by_string_set[fm_quote(
                 poll_monitor)] = fm_monitor_type::poll_monitor_type;
 
+        creator_by_string_set[fm_quote(uring_poll_monitor)] = fm_monitor_type::uring_poll_monitor_type;
+
         return creator_by_string_set;
 #undef fsw_quote
     }
@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <bitset>
+#include <deque>
+#include <map>
+#include "path_filter.h"
+
+namespace fm {
+    /* Filters whose regular expression is run at most once per path. */
+    static const size_t MAX_TRACKED_FILTERS = 256;
+
+    static char fold(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    static std::string fold(const std::string &text) {
+        std::string folded(text);
+        std::transform(folded.begin(), folded.end(), folded.begin(), [] (char c) { return fold(c); });
+        return folded;
+    }
+
+    static bool equal(const char *text, const std::string &literal, bool case_sensitive) {
+        if (case_sensitive) return memcmp(text, literal.data(), literal.size()) == 0;
+
+        for (size_t i = 0; i < literal.size(); ++i) {
+            if (fold(text[i]) != literal[i]) return false;
+        }
+
+        return true;
+    }
+
+    /*
+     * Analyzes the POSIX regular expression @p text.  If it matches a literal
+     * string, optionally anchored with ^ and $, it returns true and stores the
+     * unescaped string into @p literal.  Otherwise, it stores into @p literal
+     * the longest string that every match contains, or an empty string.
+     *
+     * The analysis is conservative: any construct that could make a character
+     * optional ends the current literal.
+     * */
+    static bool analyze_regex(const std::string &text, bool extended,
+                              std::string &literal, bool &anchored_begin, bool &anchored_end) {
+        const size_t n = text.size();
+        std::string current;
+        bool pure = true;
+        bool alternation = false;
+        unsigned int depth = 0;
+        size_t i = 0;
+
+        literal.clear();
+        anchored_begin = anchored_end = false;
+
+        auto flush = [&] () {
+            if (current.size() > literal.size()) literal = current;
+            current.clear();
+        };
+
+        /* Returns the length of the quantifier at @p j, if any. */
+        auto quantifier_length = [&] (size_t j) -> size_t {
+            if (j >= n) return 0;
+            if (text[j] == '*') return 1;
+            if (extended && (text[j] == '+' || text[j] == '?')) return 1;
+
+            size_t close = std::string::npos;
+            if (extended && text[j] == '{') close = text.find('}', j);
+            if (!extended && text[j] == '\\' && j + 1 < n && text[j + 1] == '{') close = text.find("\\}", j);
+            if (close == std::string::npos) return 0;
+
+            return close - j + (extended ? 1 : 2);
+        };
+
+        if (n > 0 && text[0] == '^') {
+            anchored_begin = true;
+            i = 1;
+        }
+
+        while (i < n) {
+            char c = text[i];
+            bool is_literal = false;
+            size_t atom_length = 1;
+
+            if (c == '$' && i == n - 1) {
+                anchored_end = true;
+                break;
+            }
+
+            if (c == '\\') {
+                if (i + 1 == n) return false;
+
+                char escaped = text[i + 1];
+                atom_length = 2;
+
+                if (isalnum(static_cast<unsigned char>(escaped))
+                    || (!extended && strchr("(){}|", escaped) != nullptr)) {
+                    pure = false;
+                    flush();
+
+                    if (!extended && escaped == '(') ++depth;
+                    if (!extended && escaped == ')' && depth > 0) --depth;
+                    if (!extended && escaped == '|') alternation = true;
+
+                    i += 2 + quantifier_length(i + 2);
+                    continue;
+                }
+
+                c = escaped;
+                is_literal = true;
+            } else if (c == '[') {
+                size_t j = i + 1;
+                if (j < n && text[j] == '^') ++j;
+                if (j < n && text[j] == ']') ++j;
+
+                while (j < n && text[j] != ']') {
+                    if (text[j] == '[' && j + 1 < n && strchr(":.=", text[j + 1]) != nullptr) {
+                        size_t close = text.find(std::string(1, text[j + 1]) + "]", j + 2);
+                        j = (close == std::string::npos) ? n : close + 2;
+                    } else {
+                        ++j;
+                    }
+                }
+
+                pure = false;
+                flush();
+                i = j + 1;
+                i += quantifier_length(i);
+                continue;
+            } else if (c == '.' || c == '^' || c == '$' || c == '*'
+                       || (extended && strchr("()|+?{}", c) != nullptr)) {
+                pure = false;
+                flush();
+
+                if (extended && c == '(') ++depth;
+                if (extended && c == ')' && depth > 0) --depth;
+                if (extended && c == '|') alternation = true;
+
+                i += 1 + (c == '(' || c == '|' ? 0 : quantifier_length(i + 1));
+                continue;
+            } else {
+                is_literal = true;
+            }
+
+            if (is_literal) {
+                size_t quantifier = quantifier_length(i + atom_length);
+
+                if (depth > 0) {
+                    pure = false;
+                    flush();
+                } else if (quantifier == 0) {
+                    current += c;
+                } else if (text[i + atom_length] == '+') {
+                    pure = false;
+                    current += c;
+                    flush();
+                } else {
+                    pure = false;
+                    flush();
+                }
+
+                i += atom_length + quantifier;
+            }
+        }
+
+        flush();
+
+        if (alternation) {
+            literal.clear();
+            return false;
+        }
+
+        return pure;
+    }
+
+    void Path_filter::Literal_automaton::build(const std::vector<std::pair<std::string, unsigned int>> &literals,
+                                               bool fold_case) {
+        transitions.clear();
+        output_offsets.clear();
+        outputs.clear();
+        class_count = 0;
+        first_byte = -1;
+
+        if (literals.empty()) return;
+
+        /* Bytes not occurring in the literals share class 0. */
+        std::fill(std::begin(byte_class), std::end(byte_class), 0);
+        class_count = 1;
+
+        for (const auto &literal : literals) {
+            for (char c : literal.first) {
+                uint16_t &byte = byte_class[static_cast<unsigned char>(c)];
+                if (byte == 0) byte = static_cast<uint16_t>(class_count++);
+            }
+        }
+
+        if (fold_case) {
+            for (int c = 'A'; c <= 'Z'; ++c) byte_class[c] = byte_class[c - 'A' + 'a'];
+        }
+
+        /* Build the trie. */
+        std::vector<std::map<unsigned int, uint32_t>> trie(1);
+        std::vector<std::vector<unsigned int>> state_outputs(1);
+
+        for (const auto &literal : literals) {
+            uint32_t state = 0;
+
+            for (char c : literal.first) {
+                unsigned int cls = byte_class[static_cast<unsigned char>(c)];
+                auto next = trie[state].find(cls);
+
+                if (next == trie[state].end()) {
+                    trie.emplace_back();
+                    state_outputs.emplace_back();
+                    next = trie[state].insert({cls, static_cast<uint32_t>(trie.size() - 1)}).first;
+                }
+
+                state = next->second;
+            }
+
+            state_outputs[state].push_back(literal.second);
+        }
+
+        /* Compute the failure links breadth first and fill the transition table. */
+        const size_t state_count = trie.size();
+        std::vector<uint32_t> failure(state_count, 0);
+        std::deque<uint32_t> queue;
+
+        transitions.assign(state_count * class_count, 0);
+
+        for (const auto &edge : trie[0]) {
+            transitions[edge.first] = edge.second;
+            queue.push_back(edge.second);
+        }
+
+        while (!queue.empty()) {
+            uint32_t state = queue.front();
+            queue.pop_front();
+
+            const std::vector<unsigned int> &inherited = state_outputs[failure[state]];
+            state_outputs[state].insert(state_outputs[state].end(), inherited.begin(), inherited.end());
+
+            for (unsigned int cls = 0; cls < class_count; ++cls) {
+                auto next = trie[state].find(cls);
+                uint32_t fallback = transitions[failure[state] * class_count + cls];
+
+                if (next == trie[state].end()) {
+                    transitions[state * class_count + cls] = fallback;
+                } else {
+                    failure[next->second] = fallback;
+                    transitions[state * class_count + cls] = next->second;
+                    queue.push_back(next->second);
+                }
+            }
+        }
+
+        for (uint32_t state = 0; state < state_count; ++state) {
+            output_offsets.push_back(static_cast<uint32_t>(outputs.size()));
+            outputs.insert(outputs.end(), state_outputs[state].begin(), state_outputs[state].end());
+        }
+        output_offsets.push_back(static_cast<uint32_t>(outputs.size()));
+
+        /* If a single byte leaves the root, the scan skips to it with memchr. */
+        for (int c = 0; c < 256; ++c) {
+            if (transitions[byte_class[c]] == 0) continue;
+
+            if (first_byte != -1) {
+                first_byte = -1;
+                break;
+            }
+
+            first_byte = c;
+        }
+    }
+
+    void Path_filter::add(const Monitor_filter &filter) {
+        std::regex::flag_type regex_flags = filter.extended ? std::regex::extended : std::regex::basic;
+
+        if (!filter.case_sensitive) {
+            regex_flags |= std::regex::icase;
+        }
+
+        compiled_filter compiled{{std::regex(filter.text, regex_flags), filter.type},
+                                 match_regex,
+                                 filter.case_sensitive,
+                                 filter.text.find('$') == std::string::npos,
+                                 std::string()};
+        bool anchored_begin;
+        bool anchored_end;
+
+        if (analyze_regex(filter.text, filter.extended, compiled.literal, anchored_begin, anchored_end)
+            && !compiled.literal.empty()) {
+            if (anchored_begin && anchored_end) compiled.kind = match_exact;
+            else if (anchored_begin) compiled.kind = match_prefix;
+            else if (anchored_end) compiled.kind = match_suffix;
+            else compiled.kind = match_substring;
+        }
+
+        if (!filter.case_sensitive) compiled.literal = fold(compiled.literal);
+        if (filter.type == fm_filter_type::filter_include) has_includes = true;
+
+        if (compiled.subtree_closed) {
+            ++(filter.type == fm_filter_type::filter_include ? closed_includes : closed_excludes);
+        }
+
+        filters.push_back(std::move(compiled));
+        rebuild_automata();
+    }
+
+    void Path_filter::clear() {
+        filters.clear();
+        has_includes = false;
+        closed_includes = 0;
+        closed_excludes = 0;
+        rebuild_automata();
+    }
+
+    void Path_filter::rebuild_automata() {
+        std::vector<std::pair<std::string, unsigned int>> sensitive;
+        std::vector<std::pair<std::string, unsigned int>> insensitive;
+
+        direct_filters.clear();
+
+        for (unsigned int i = 0; i < filters.size(); ++i) {
+            const compiled_filter &filter = filters[i];
+
+            if ((filter.kind == match_substring || filter.kind == match_regex) && !filter.literal.empty()) {
+                (filter.case_sensitive ? sensitive : insensitive).push_back({filter.literal, i});
+            } else {
+                direct_filters.push_back(i);
+            }
+        }
+
+        sensitive_literals.build(sensitive, false);
+        insensitive_literals.build(insensitive, true);
+    }
+
+    bool Path_filter::matches(const compiled_filter &filter, const char *path, size_t length) const {
+        const std::string &literal = filter.literal;
+
+        switch (filter.kind) {
+            case match_prefix:
+                return length >= literal.size() && equal(path, literal, filter.case_sensitive);
+            case match_suffix:
+                return length >= literal.size() && equal(path + length - literal.size(), literal, filter.case_sensitive);
+            case match_exact:
+                return length == literal.size() && equal(path, literal, filter.case_sensitive);
+            case match_substring:
+                return true;
+            default:
+                return std::regex_search(path, path + length, filter.compiled.regex);
+        }
+    }
+
+    bool Path_filter::can_decide_subtrees() const {
+        return has_includes ? closed_includes > 0 : closed_excludes > 0;
+    }
+
+    fm_subtree_verdict Path_filter::decide_subtree(const char *path, size_t length) const {
+        for (const compiled_filter &filter : filters) {
+            if (!filter.subtree_closed) continue;
+
+            /* Exclusions are only definitive if nothing can include a path back. */
+            bool is_include = (filter.compiled.type == fm_filter_type::filter_include);
+            if (is_include != has_includes) continue;
+
+            bool found;
+
+            if (filter.kind != match_substring) {
+                found = matches(filter, path, length);
+            } else if (filter.case_sensitive) {
+                found = memmem(path, length, filter.literal.data(), filter.literal.size()) != nullptr;
+            } else {
+                found = false;
+                for (size_t i = 0; !found && i + filter.literal.size() <= length; ++i) {
+                    found = equal(path + i, filter.literal, false);
+                }
+            }
+
+            if (found) return is_include ? subtree_accepted : subtree_rejected;
+        }
+
+        return subtree_undecided;
+    }
+
+    void Path_filter::match_all(const char *path, size_t length, std::vector<unsigned int> &matched) const {
+        std::bitset<MAX_TRACKED_FILTERS> evaluated;
+
+        auto on_match = [&] (unsigned int i) -> bool {
+            if (i < MAX_TRACKED_FILTERS) {
+                if (evaluated[i]) return false;
+                evaluated[i] = true;
+            }
+
+            if (filters[i].kind == match_regex && !matches(filters[i], path, length)) return false;
+
+            matched.push_back(i);
+            return false;
+        };
+
+        for (unsigned int i : direct_filters) {
+            if (filters[i].kind == match_regex || matches(filters[i], path, length)) on_match(i);
+        }
+
+        sensitive_literals.scan(path, length, on_match);
+        insensitive_literals.scan(path, length, on_match);
+    }
+
+    bool Path_filter::accept(const char *path, size_t length) const {
+        if (filters.empty()) return true;
+
+        bool included = false;
+        bool excluded = false;
+        std::bitset<MAX_TRACKED_FILTERS> evaluated;
+
+        /* Returns true when the outcome is known. */
+        auto on_match = [&] (unsigned int i) -> bool {
+            const compiled_filter &filter = filters[i];
+            bool is_include = (filter.compiled.type == fm_filter_type::filter_include);
+
+            if (!is_include && excluded) return false;
+
+            if (filter.kind == match_regex) {
+                if (i < MAX_TRACKED_FILTERS) {
+                    if (evaluated[i]) return false;
+                    evaluated[i] = true;
+                }
+
+                if (!matches(filter, path, length)) return false;
+            }
+
+            if (is_include) {
+                included = true;
+                return true;
+            }
+
+            excluded = true;
+            return !has_includes;
+        };
+
+        /* Anchored literals first, since they are the cheapest. */
+        for (unsigned int i : direct_filters) {
+            if (filters[i].kind == match_regex || !matches(filters[i], path, length)) continue;
+            if (on_match(i)) return included || !excluded;
+        }
+
+        if (sensitive_literals.scan(path, length, on_match)) return included || !excluded;
+        if (insensitive_literals.scan(path, length, on_match)) return included || !excluded;
+
+        /* Then the regular expressions without a literal to look for. */
+        for (unsigned int i : direct_filters) {
+            if (filters[i].kind != match_regex) continue;
+            if (on_match(i)) return included || !excluded;
+        }
+
+        return !excluded;
+    }
+}
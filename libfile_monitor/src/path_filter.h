@@ -0,0 +1,179 @@
+/*
+ * @brief Header of the fm::Path_filter class.
+ *
+ * This header file defines the fm::Path_filter class, the engine evaluating
+ * the path filters of a monitor.
+ * */
+
+#ifndef FILE_MONITOR_PATH_FILTER_H
+#define FILE_MONITOR_PATH_FILTER_H
+
+#include <string>
+#include <vector>
+#include <regex>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "filter.h"
+
+namespace fm {
+
+    /*
+     * The verdict shared by all the paths below a directory.
+     * */
+    enum fm_subtree_verdict {
+        subtree_undecided = 0,  /* Paths below the directory must be checked. */
+        subtree_accepted,       /* All paths below the directory are accepted. */
+        subtree_rejected        /* All paths below the directory are rejected. */
+    };
+
+    typedef struct _compiled_monitor_filter {
+        std::regex regex;
+        fm_filter_type type;
+    }COMPILED_MONITOR_FILTER_S;
+
+    /*
+     * @brief Compiled set of include and exclude path filters.
+     *
+     * A path is accepted if it matches any inclusion filter or if it matches no
+     * exclusion filter, as it always was.  Running std::regex_search for every
+     * filter on every path is slow, hence filters are analyzed when they are
+     * added:
+     *
+     *   - Regular expressions matching a literal string, such as `\.git/`, are
+     *     matched as substrings.  Literals anchored with `^` and `$` are
+     *     compared as a prefix, a suffix or the whole path.
+     *
+     *   - For the other regular expressions, the longest literal string that
+     *     every match must contain is extracted, if any, and the regular
+     *     expression is only run on the paths containing it.
+     *
+     * The unanchored literals of all the filters are compiled into a single
+     * Aho-Corasick automaton (one for the case sensitive filters and one for
+     * the case insensitive ones), so that a path is scanned once regardless of
+     * the number of filters.  Case insensitive filters fold ASCII letters, as
+     * std::regex::icase does in the "C" locale.
+     *
+     * accept() does not modify the object and may be called concurrently.
+     * */
+    class Path_filter {
+    public:
+        Path_filter() = default;
+
+        /*
+         * Compiles and adds @p filter.  std::regex_error is thrown if its
+         * regular expression is not valid.
+         * */
+        void add(const Monitor_filter &filter);
+        void clear();
+
+        bool empty() const { return filters.empty(); }
+        size_t size() const { return filters.size(); }
+
+        bool accept(const char *path, size_t length) const;
+        bool accept(const std::string &path) const { return accept(path.data(), path.size()); }
+
+        /*
+         * Appends to @p matched the indices of the filters matching @p path,
+         * scanning it once for all of them.  An index may be appended more than
+         * once.
+         * */
+        void match_all(const char *path, size_t length, std::vector<unsigned int> &matched) const;
+        fm_filter_type get_type(unsigned int index) const { return filters[index].compiled.type; }
+
+        /*
+         * Returns the verdict shared by all the paths below the directory
+         * @p path.  A filter whose match cannot depend on what follows it (it
+         * contains no `$`) and that matches the directory matches all the paths
+         * below it: they are accepted if it is an inclusion filter, and rejected
+         * if it is an exclusion filter and there are no inclusion filters.
+         * */
+        fm_subtree_verdict decide_subtree(const char *path, size_t length) const;
+
+        /*
+         * Returns false if decide_subtree() can only return subtree_undecided.
+         * */
+        bool can_decide_subtrees() const;
+
+    private:
+        enum match_kind {
+            match_substring,   /* The filter matches a literal string. */
+            match_prefix,      /* The filter matches a literal string anchored with ^. */
+            match_suffix,      /* The filter matches a literal string anchored with $. */
+            match_exact,       /* The filter matches a literal string anchored with ^ and $. */
+            match_regex        /* The regular expression must be run. */
+        };
+
+        struct compiled_filter {
+            COMPILED_MONITOR_FILTER_S compiled;
+            match_kind kind;
+            bool case_sensitive;
+            bool subtree_closed;    // a match implies a match of every longer path
+            std::string literal;    // the literal, or a string every match contains
+        };
+
+        /*
+         * Aho-Corasick automaton over a set of literals, stored as a dense
+         * transition table over the classes of the bytes occurring in them.
+         * */
+        class Literal_automaton {
+        public:
+            void build(const std::vector<std::pair<std::string, unsigned int>> &literals, bool fold_case);
+
+            bool empty() const { return class_count == 0; }
+
+            /*
+             * Calls @p on_match(filter) for each occurrence of a literal in
+             * @p path, until it returns true.  Returns whether it did.
+             * */
+            template<typename Match>
+            bool scan(const char *path, size_t length, Match on_match) const;
+
+        private:
+            uint16_t byte_class[256];
+            unsigned int class_count = 0;
+            int first_byte = -1;                   // the only byte leaving the root, if any
+            std::vector<uint32_t> transitions;     // state * class_count + class
+            std::vector<uint32_t> output_offsets;  // state -> range of outputs
+            std::vector<unsigned int> outputs;     // the filters matching in a state
+        };
+
+        bool matches(const compiled_filter &filter, const char *path, size_t length) const;
+        void rebuild_automata();
+
+        std::vector<compiled_filter> filters;
+        std::vector<unsigned int> direct_filters;   // filters not in an automaton
+        Literal_automaton sensitive_literals;
+        Literal_automaton insensitive_literals;
+        bool has_includes = false;
+        unsigned int closed_includes = 0;
+        unsigned int closed_excludes = 0;
+    };
+
+    template<typename Match>
+    bool Path_filter::Literal_automaton::scan(const char *path, size_t length, Match on_match) const {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(path);
+        const unsigned char *end = p + length;
+        uint32_t state = 0;
+
+        if (empty()) return false;
+
+        while (p < end) {
+            /* Skip to the next occurrence of the only byte leaving the root. */
+            if (state == 0 && first_byte >= 0) {
+                p = static_cast<const unsigned char *>(memchr(p, first_byte, end - p));
+                if (p == nullptr) return false;
+            }
+
+            state = transitions[state * class_count + byte_class[*p++]];
+
+            for (uint32_t o = output_offsets[state]; o < output_offsets[state + 1]; ++o) {
+                if (on_match(outputs[o])) return true;
+            }
+        }
+
+        return false;
+    }
+}
+
+#endif //FILE_MONITOR_PATH_FILTER_H
@@ -0,0 +1,269 @@
+#include <cstring>
+#include "path_tree.h"
+
+namespace fm {
+    static const size_t MIN_SLOTS = 16;
+    static const size_t MIN_COMPACTION_BYTES = 64 * 1024;
+
+    const Path_tree::node_id Path_tree::npos;
+    const Path_tree::node_id Path_tree::DELETED_SLOT;
+
+    uint32_t Path_tree::hash_child(node_id parent, const char *name, size_t length) {
+        /* FNV-1a of the parent identifier followed by the name. */
+        uint32_t hash = 2166136261u;
+
+        for (int i = 0; i < 4; ++i) {
+            hash ^= (parent >> (i * 8)) & 0xff;
+            hash *= 16777619u;
+        }
+
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= static_cast<unsigned char>(name[i]);
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+    bool Path_tree::matches(const path_node &node, node_id parent, const char *name, size_t length) const {
+        return node.parent == parent &&
+               node.name_length == length &&
+               memcmp(&names[node.name_offset], name, length) == 0;
+    }
+
+    size_t Path_tree::find_slot(node_id parent, const char *name, size_t length, uint32_t hash) const {
+        if (slots.empty()) return SIZE_MAX;
+
+        const size_t mask = slots.size() - 1;
+
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            node_id id = slots[i];
+
+            if (id == npos) return SIZE_MAX;
+            if (id == DELETED_SLOT) continue;
+
+            const path_node &node = nodes[id];
+            if (node.hash == hash && matches(node, parent, name, length)) return i;
+        }
+    }
+
+    void Path_tree::rehash(size_t capacity) {
+        std::vector<node_id> new_slots(capacity, npos);
+        const size_t mask = capacity - 1;
+
+        for (size_t id = 0; id < nodes.size(); ++id) {
+            if (!nodes[id].references) continue;
+
+            size_t i = nodes[id].hash & mask;
+            while (new_slots[i] != npos) i = (i + 1) & mask;
+            new_slots[i] = static_cast<node_id>(id);
+        }
+
+        slots.swap(new_slots);
+        deleted_count = 0;
+    }
+
+    void Path_tree::compact_names() {
+        std::vector<char> compacted;
+        compacted.reserve(names.size() - freed_name_bytes);
+
+        for (path_node &node : nodes) {
+            if (!node.references) continue;
+
+            uint32_t offset = static_cast<uint32_t>(compacted.size());
+            compacted.insert(compacted.end(),
+                             names.begin() + node.name_offset,
+                             names.begin() + node.name_offset + node.name_length);
+            node.name_offset = offset;
+        }
+
+        names.swap(compacted);
+        freed_name_bytes = 0;
+    }
+
+    Path_tree::node_id Path_tree::acquire_child(node_id parent, const char *name, size_t length) {
+        uint32_t hash = hash_child(parent, name, length);
+        size_t slot = find_slot(parent, name, length, hash);
+
+        if (slot != SIZE_MAX) {
+            ++nodes[slots[slot]].references;
+            return slots[slot];
+        }
+
+        /* Keep the load factor, tombstones included, below 1/2. */
+        if ((node_count + deleted_count + 1) * 2 > slots.size()) {
+            size_t capacity = slots.empty() ? MIN_SLOTS : slots.size();
+            while ((node_count + 1) * 2 > capacity) capacity *= 2;
+            rehash(capacity);
+        }
+
+        node_id id;
+        if (!free_nodes.empty()) {
+            id = free_nodes.back();
+            free_nodes.pop_back();
+        } else {
+            id = static_cast<node_id>(nodes.size());
+            nodes.push_back(path_node());
+        }
+
+        path_node &node = nodes[id];
+        node.parent = parent;
+        node.name_offset = static_cast<uint32_t>(names.size());
+        node.name_length = static_cast<uint16_t>(length);
+        node.hash = hash;
+        node.references = 1;
+        names.insert(names.end(), name, name + length);
+
+        /* The child holds a reference on its parent. */
+        if (parent != npos) ++nodes[parent].references;
+
+        const size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i] != npos && slots[i] != DELETED_SLOT) i = (i + 1) & mask;
+
+        if (slots[i] == DELETED_SLOT) --deleted_count;
+        slots[i] = id;
+        ++node_count;
+
+        return id;
+    }
+
+    Path_tree::node_id Path_tree::acquire(const std::string &path) {
+        const char *begin = path.c_str();
+        const char *end = begin + path.size();
+        node_id node = npos;
+
+        /* An absolute path starts with the root node, whose name is empty. */
+        if (begin != end && *begin == '/') node = acquire_child(npos, begin, 0);
+
+        for (const char *p = begin; p < end;) {
+            const char *separator = static_cast<const char *>(memchr(p, '/', end - p));
+            if (!separator) separator = end;
+
+            if (separator != p) {
+                node_id child = acquire_child(node, p, separator - p);
+
+                /* The temporary reference on the parent is held by the child now. */
+                if (node != npos) release(node);
+                node = child;
+            }
+
+            p = separator + 1;
+        }
+
+        return node;
+    }
+
+    void Path_tree::acquire(node_id node) {
+        ++nodes[node].references;
+    }
+
+    void Path_tree::release(node_id node) {
+        while (node != npos) {
+            path_node &current = nodes[node];
+            if (--current.references) return;
+
+            size_t slot = find_slot(current.parent,
+                                    &names[current.name_offset],
+                                    current.name_length,
+                                    current.hash);
+            slots[slot] = DELETED_SLOT;
+            ++deleted_count;
+            --node_count;
+
+            freed_name_bytes += current.name_length;
+            free_nodes.push_back(node);
+            node = current.parent;
+        }
+
+        if (freed_name_bytes > MIN_COMPACTION_BYTES && freed_name_bytes * 2 > names.size()) {
+            compact_names();
+        }
+    }
+
+    Path_tree::node_id Path_tree::find_child(node_id parent, const char *name, size_t length) const {
+        size_t slot = find_slot(parent, name, length, hash_child(parent, name, length));
+        return slot == SIZE_MAX ? npos : slots[slot];
+    }
+
+    Path_tree::node_id Path_tree::find(const std::string &path) const {
+        const char *begin = path.c_str();
+        const char *end = begin + path.size();
+        node_id node = npos;
+
+        if (begin != end && *begin == '/') {
+            node = find_child(npos, begin, 0);
+            if (node == npos) return npos;
+        }
+
+        for (const char *p = begin; p < end;) {
+            const char *separator = static_cast<const char *>(memchr(p, '/', end - p));
+            if (!separator) separator = end;
+
+            if (separator != p) {
+                node = find_child(node, p, separator - p);
+                if (node == npos) return npos;
+            }
+
+            p = separator + 1;
+        }
+
+        return node;
+    }
+
+    Path_tree::node_id Path_tree::get_parent(node_id node) const {
+        return nodes[node].parent;
+    }
+
+    const char *Path_tree::get_name(node_id node, size_t &length) const {
+        length = nodes[node].name_length;
+        return names.data() + nodes[node].name_offset;
+    }
+
+    void Path_tree::get_path(node_id node, std::string &path) const {
+        size_t length = 0;
+
+        for (node_id id = node; id != npos; id = nodes[id].parent) {
+            length += nodes[id].name_length;
+            if (nodes[id].parent != npos) ++length;
+        }
+
+        /* The root node alone. */
+        if (!length) {
+            path.assign(1, '/');
+            return;
+        }
+
+        path.resize(length);
+
+        for (node_id id = node; id != npos; id = nodes[id].parent) {
+            const path_node &current = nodes[id];
+
+            length -= current.name_length;
+            memcpy(&path[length], &names[current.name_offset], current.name_length);
+
+            if (current.parent != npos) path[--length] = '/';
+        }
+    }
+
+    std::string Path_tree::get_path(node_id node) const {
+        std::string path;
+        get_path(node, path);
+        return path;
+    }
+
+    size_t Path_tree::size() const {
+        return node_count;
+    }
+
+    size_t Path_tree::capacity() const {
+        return nodes.size();
+    }
+
+    size_t Path_tree::memory_usage() const {
+        return nodes.capacity() * sizeof(path_node) +
+               free_nodes.capacity() * sizeof(node_id) +
+               slots.capacity() * sizeof(node_id) +
+               names.capacity();
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * @brief Header of the fm::Path_tree class.
+ *
+ * This header file defines the fm::Path_tree class, the interned path store
+ * shared by the monitors to track the paths they observe.
+ * */
+
+#ifndef FILE_MONITOR_PATH_TREE_H
+#define FILE_MONITOR_PATH_TREE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace fm {
+    /*
+     * @brief Tree of interned paths.
+     *
+     * Each node stores the identifier of its parent and its own name component,
+     * so that common prefixes are stored only once.  Full paths are
+     * materialized by get_path() only when needed, for example when an event
+     * is emitted.
+     *
+     * Nodes are reference counted: acquire() interns a path and takes a
+     * reference on its node, and release() drops it.  A node keeps a reference
+     * on its parent, so that a node is freed when it is neither acquired nor
+     * the parent of another node.  Node identifiers are small integers that are
+     * reused after being freed, and can be used to index side tables.
+     *
+     * Paths are split on '/': empty components are ignored, except the leading
+     * one of an absolute path which is the root node.
+     *
+     * This class is not thread-safe.
+     * */
+    class Path_tree {
+    public:
+        typedef uint32_t node_id;
+        static const node_id npos = UINT32_MAX;
+
+        /*
+         * Interns @p path and acquires a reference on its node.
+         * */
+        node_id acquire(const std::string &path);
+
+        /*
+         * Interns the child @p name of @p parent and acquires a reference on
+         * its node.  If @p parent is npos, @p name is a top-level node.
+         * */
+        node_id acquire_child(node_id parent, const char *name, size_t length);
+
+        /*
+         * Acquires another reference on @p node.
+         * */
+        void acquire(node_id node);
+
+        /*
+         * Releases a reference on @p node, freeing the node and, recursively,
+         * its unreferenced parents.
+         * */
+        void release(node_id node);
+
+        /*
+         * Returns the node of @p path, or npos if @p path is not interned.
+         * */
+        node_id find(const std::string &path) const;
+        node_id find_child(node_id parent, const char *name, size_t length) const;
+
+        node_id get_parent(node_id node) const;
+        const char *get_name(node_id node, size_t &length) const;
+
+        /*
+         * Materializes the full path of @p node into @p path, reusing its
+         * storage.
+         * */
+        void get_path(node_id node, std::string &path) const;
+        std::string get_path(node_id node) const;
+
+        /*
+         * Returns the number of live nodes.
+         * */
+        size_t size() const;
+
+        /*
+         * Returns an upper bound of the node identifiers in use, suitable to
+         * size tables indexed by node identifier.
+         * */
+        size_t capacity() const;
+
+        /*
+         * Returns the number of bytes allocated by the tree.
+         * */
+        size_t memory_usage() const;
+
+    private:
+        struct path_node {
+            node_id parent;
+            uint32_t name_offset;
+            uint32_t hash;
+            uint32_t references;
+            uint16_t name_length;
+        };
+
+        static const node_id DELETED_SLOT = UINT32_MAX - 1;
+
+        static uint32_t hash_child(node_id parent, const char *name, size_t length);
+        bool matches(const path_node &node, node_id parent, const char *name, size_t length) const;
+        size_t find_slot(node_id parent, const char *name, size_t length, uint32_t hash) const;
+        void rehash(size_t capacity);
+        void compact_names();
+
+        std::vector<path_node> nodes;
+        std::vector<node_id> free_nodes;
+        std::vector<node_id> slots;     // open-addressing (parent, name) index
+        std::vector<char> names;        // name components
+        size_t node_count = 0;
+        size_t deleted_count = 0;
+        size_t freed_name_bytes = 0;
+    };
+}
+
+#endif //FILE_MONITOR_PATH_TREE_H
@@ -2,7 +2,14 @@
 #include <cstdlib>
 #include <cstdio>
 #include <errno.h>
+#include <cstring>
+#include <cstdint>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
 #include <iostream>
 #include <system_error>
 #include "path_utils.h"
@@ -10,23 +17,152 @@
 using namespace std;
 
 namespace fm {
-    vector<string> get_directory_children(const string &path) {
-        vector<string> children;
-        DIR *dir = opendir(path.c_str());
+#if defined(__linux__)
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+#endif
 
-        if (!dir) {
+    static const size_t DIRECTORY_BUFFER_SIZE = 32 * 1024;
+
+    Directory_reader::Directory_reader() {
+#if defined(__linux__)
+        buffer.resize(DIRECTORY_BUFFER_SIZE);
+#endif
+    }
+
+    Directory_reader::~Directory_reader() {
+        close();
+    }
+
+    bool Directory_reader::open(const string &path) {
+        return open_directory(AT_FDCWD, path.c_str(), 0);
+    }
+
+    bool Directory_reader::open_at(int dir_fd, const char *name) {
+        return open_directory(dir_fd, name, O_NOFOLLOW);
+    }
+
+    bool Directory_reader::open_directory(int dir_fd, const char *name, int flags) {
+        close();
+
+        fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | flags);
+
+        if (fd == -1) {
             if (errno == EMFILE || errno == ENFILE) {
-                perror("opendir");
+                perror("openat");
             }
 
-            return children;
+            return false;
         }
 
-        while (struct dirent *entry = readdir(dir)) {
-            children.emplace_back(entry->d_name);
+#if !defined(__linux__)
+        int dir_handle_fd = dup(fd);
+        dir = fdopendir(dir_handle_fd);
+
+        if (!dir) {
+            ::close(dir_handle_fd);
+            close();
+            return false;
+        }
+#endif
+
+        return true;
+    }
+
+    void Directory_reader::close() {
+#if !defined(__linux__)
+        if (dir) closedir(static_cast<DIR *>(dir));
+        dir = nullptr;
+#endif
+        if (fd != -1) ::close(fd);
+
+        fd = -1;
+        offset = size = 0;
+    }
+
+    int Directory_reader::release() {
+        const int released_fd = fd;
+
+#if !defined(__linux__)
+        if (dir) closedir(static_cast<DIR *>(dir));
+        dir = nullptr;
+#endif
+        fd = -1;
+        offset = size = 0;
+
+        return released_fd;
+    }
+
+    int Directory_reader::get_fd() const {
+        return fd;
+    }
+
+    bool Directory_reader::fill() {
+#if defined(__linux__)
+        long read_bytes = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+
+        if (read_bytes <= 0) return false;
+
+        offset = 0;
+        size = static_cast<size_t>(read_bytes);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool Directory_reader::next(DIRECTORY_ENTRY &entry) {
+        if (fd == -1) return false;
+
+        for (;;) {
+#if defined(__linux__)
+            if (offset >= size && !fill()) return false;
+
+            const linux_dirent64 *dirent = reinterpret_cast<const linux_dirent64 *>(buffer.data() + offset);
+            offset += dirent->d_reclen;
+
+            entry.name = dirent->d_name;
+            entry.type = dirent->d_type;
+            entry.inode = static_cast<ino_t>(dirent->d_ino);
+#else
+            struct dirent *dirent = readdir(static_cast<DIR *>(dir));
+            if (!dirent) return false;
+
+            entry.name = dirent->d_name;
+            entry.type = dirent->d_type;
+            entry.inode = dirent->d_ino;
+#endif
+            entry.name_length = strlen(entry.name);
+
+            if (entry.name[0] == '.' &&
+                (entry.name_length == 1 || (entry.name_length == 2 && entry.name[1] == '.'))) {
+                continue;
+            }
+
+            return true;
+        }
+    }
+
+    bool lstat_at(int dir_fd, const char *name, struct stat &fd_stat) {
+        return fstatat(dir_fd, name, &fd_stat, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+
+    vector<string> get_directory_children(const string &path) {
+        vector<string> children;
+        Directory_reader reader;
+
+        if (!reader.open(path)) return children;
+
+        DIRECTORY_ENTRY entry;
+        while (reader.next(entry)) {
+            children.emplace_back(entry.name, entry.name_length);
         }
 
-        closedir(dir);
         return children;
     }
 
@@ -7,9 +7,74 @@
 #include <sys/stat.h>
 
 namespace fm {
+    /*
+     * Directory entry returned by Directory_reader.  The name is owned by the
+     * reader and is valid until the next call to Directory_reader::next().
+     * */
+    typedef struct _directory_entry {
+        const char *name;
+        size_t name_length;
+        unsigned char type;     /* DT_* constant, DT_UNKNOWN if not reported. */
+        ino_t inode;
+    }DIRECTORY_ENTRY;
+
+    /*
+     * @brief Reader of directory entries.
+     *
+     * Entries are read with getdents64() into a buffer reused across
+     * directories, and their type is reported as returned by the file system,
+     * so that callers can skip stat() calls when the type is all they need.
+     * The "." and ".." entries are skipped.  The directory descriptor can be
+     * used with lstat_at() to stat entries without resolving their full path.
+     * */
+    class Directory_reader {
+    public:
+        Directory_reader();
+        ~Directory_reader();
+        Directory_reader(const Directory_reader &orig) = delete;
+        Directory_reader &operator=(const Directory_reader &that) = delete;
+
+        bool open(const std::string &path);
+
+        /*
+         * Opens the directory @p name relative to the directory descriptor
+         * @p dir_fd.  @p name is not followed if it is a symbolic link.
+         * */
+        bool open_at(int dir_fd, const char *name);
+        void close();
+
+        /*
+         * Closes the reader but not its directory descriptor, which is
+         * returned and must be closed by the caller.
+         * */
+        int release();
+
+        /*
+         * Reads the next entry.  Returns false at the end of the directory or
+         * on error.
+         * */
+        bool next(DIRECTORY_ENTRY &entry);
+        int get_fd() const;
+
+    private:
+        bool open_directory(int dir_fd, const char *name, int flags);
+        bool fill();
+
+        int fd = -1;
+        std::vector<char> buffer;
+        size_t offset = 0;
+        size_t size = 0;
+#if !defined(__linux__)
+        void *dir = nullptr;
+#endif
+    };
+
+    /* lstat() of @p name relative to the directory descriptor @p dir_fd. */
+    bool lstat_at(int dir_fd, const char *name, struct stat &fd_stat);
+
     std::string fm_realpath(const char *path, char *resolved_path);
 
-    /* Gets a vector of direct directory children. */
+    /* Gets a vector of direct directory children, excluding "." and "..". */
     std::vector<std::string> get_directory_children(const std::string &path);
     bool read_link_path(const std::string &path, std::string &link_path);
     bool lstat_path(const std::string &path, struct stat &fd_stat);
@@ -1,154 +1,938 @@
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <ctime>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
 #include "monitor.h"
 #include "event.h"
 #include "poll_monitor.h"
 #include "path_utils.h"
+#include "crawler.h"
+#include "stat_batch.h"
+#include "exception.h"
+#include "string_utils.h"
 
 using std::string;
 using std::vector;
 using std::unique_lock;
 using std::mutex;
 
-#define FM_MTIME(stat) ((stat).st_mtime)
-#define FM_CTIME(stat) ((stat).st_ctime)
+#if defined(__linux__)
+#  define FM_MTIME_NS(stat) ((stat).st_mtim.tv_sec * 1000000000LL + (stat).st_mtim.tv_nsec)
+#  define FM_CTIME_NS(stat) ((stat).st_ctim.tv_sec * 1000000000LL + (stat).st_ctim.tv_nsec)
+#else
+#  define FM_MTIME_NS(stat) ((stat).st_mtime * 1000000000LL)
+#  define FM_CTIME_NS(stat) ((stat).st_ctime * 1000000000LL)
+#endif
 
 namespace fm {
+    /*
+     * A directory modified less than this interval before it was listed may
+     * have been modified again within the same timestamp tick after it was
+     * listed: it is listed again at the next poll.
+     */
+    static const long long RACY_INTERVAL_NS = 1000000000LL;
+
+    static long long get_time_ns(const struct timespec &time) {
+        return time.tv_sec * 1000000000LL + time.tv_nsec;
+    }
+
+    static long long get_steady_time_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
     Poll_monitor::Poll_monitor(std::vector<string> paths,
                               FM_EVENT_CALLBACK *callback,
                                void *context) :
         Monitor(std::move(paths), callback, context)
     {
-        previous_data = new POLL_MONITOR_DATA();
-        new_data = new POLL_MONITOR_DATA();
-        time(&curr_time);
+        clock_gettime(CLOCK_REALTIME, &curr_time);
     }
 
     Poll_monitor::~Poll_monitor() {
-        delete previous_data;
-        delete new_data;
     }
 
-    bool Poll_monitor::initial_scan_callback(const std::string &path, const struct stat &fd_stat) {
-        if (previous_data->tracked_files.count(path)) return false;
+    void Poll_monitor::add_event(Path_tree::node_id node, fm_event_mask flags) {
+        tracked_paths.get_path(node, event_path);
+        events.add(event_path, curr_time, flags);
+    }
 
-        WATCHED_FILE_INFO wfi{FM_MTIME(fd_stat), FM_CTIME(fd_stat)};
-        previous_data->tracked_files[path] = wfi;
+    void Poll_monitor::set_state(tracked_entry &entry, const struct stat &fd_stat) {
+        entry.is_dir = S_ISDIR(fd_stat.st_mode);
+        entry.link_count = static_cast<uint16_t>(std::min<unsigned long long>(fd_stat.st_nlink, UINT16_MAX));
+        entry.device = fd_stat.st_dev;
+        entry.inode = fd_stat.st_ino;
+        entry.size = fd_stat.st_size;
+        entry.mtime_ns = FM_MTIME_NS(fd_stat);
+        entry.ctime_ns = FM_CTIME_NS(fd_stat);
+    }
+
+    fm_event_mask Poll_monitor::get_changes(const tracked_entry &previous, const tracked_entry &current) {
+        fm_event_mask flags = NoOp;
+
+        if (current.mtime_ns != previous.mtime_ns || current.size != previous.size) {
+            flags |= fm_event_flag::Updated;
+        }
+
+        if (current.ctime_ns != previous.ctime_ns) {
+            flags |= fm_event_flag::AttributeModified;
+        }
+
+        return flags;
+    }
+
+    bool Poll_monitor::is_replaced(const tracked_entry &previous, const tracked_entry &current) {
+        return current.is_dir != previous.is_dir ||
+               current.device != previous.device ||
+               current.inode != previous.inode;
+    }
+
+    Poll_monitor::tracked_entry &Poll_monitor::get_entry(Path_tree::node_id node) {
+        if (node >= tracked_entries.size()) {
+            tracked_entries.resize(std::max(static_cast<size_t>(node) + 1, tracked_paths.capacity()), tracked_entry());
+        }
+
+        return tracked_entries[node];
+    }
+
+    bool Poll_monitor::is_tracked(Path_tree::node_id node) const {
+        return node < tracked_entries.size() && tracked_entries[node].generation != 0;
+    }
+
+    void Poll_monitor::track(Path_tree::node_id node, const struct stat &fd_stat) {
+        tracked_entry &entry = get_entry(node);
+
+        set_state(entry, fd_stat);
+        entry.generation = generation;
+        tracked_paths.acquire(node);
+        ++tracked_count;
+    }
+
+    bool Poll_monitor::initial_scan_callback(Path_tree::node_id node, const struct stat &fd_stat) {
+        if (is_tracked(node)) return false;
+
+        track(node, fd_stat);
 
         return true;
     }
 
-    bool Poll_monitor::intermediate_scan_callback(const std::string &path, const struct stat &fd_stat) {
-        if (new_data->tracked_files.count(path)) return false;
+    bool Poll_monitor::intermediate_scan_callback(Path_tree::node_id node, const struct stat &fd_stat) {
+        if (!is_tracked(node)) {
+            track(node, fd_stat);
+            created_nodes.push_back(node);
 
-        WATCHED_FILE_INFO wfi{FM_MTIME(fd_stat), FM_CTIME(fd_stat)};
-        new_data->tracked_files[path] = wfi;
+            return true;
+        }
 
-        if (previous_data->tracked_files.count(path)) {
-            WATCHED_FILE_INFO pwfi = previous_data->tracked_files[path];
-            vector<fm_event_flag> flags;
+        tracked_entry &entry = tracked_entries[node];
 
-            if (FM_MTIME(fd_stat) > pwfi.mtime) {
-                flags.push_back(fm_event_flag::Updated);
-            }
+        /* The node has been reached by another path during this poll. */
+        if (entry.generation == generation) return false;
 
-            if (FM_CTIME(fd_stat) >pwfi.ctime) {
-                flags.push_back(fm_event_flag::AttributeModified);
-            }
+        tracked_entry current = entry;
+        set_state(current, fd_stat);
 
-            if (!flags.empty()) {
-                events.emplace_back(path, curr_time, flags);
-            }
+        /*
+         * An entry replaced by another object is reported as removed and
+         * created, so that a file moved over it is reported as moved.  The
+         * removed node is released with the others.
+         */
+        if (is_replaced(entry, current)) {
+            tracked_paths.acquire(node);
+            replaced_entries.emplace(node, entry);
+            removed_nodes.push_back(node);
+            created_nodes.push_back(node);
+        } else {
+            fm_event_mask flags = get_changes(entry, current);
+            if (flags != NoOp) add_event(node, flags);
+        }
+
+        entry = current;
+        entry.generation = generation;
 
-            previous_data->tracked_files.erase(path);
+        return true;
+    }
+
+    bool Poll_monitor::incremental_scan_callback(Path_tree::node_id node, const struct stat &fd_stat) {
+        if (is_tracked(node)) return false;
+
+        track(node, fd_stat);
+        created_nodes.push_back(node);
+
+        auto parent = directories.find(tracked_paths.get_parent(node));
+
+        if (parent != directories.end()) {
+            parent->second.children.push_back(node);
         } else {
-            vector<fm_event_flag> flags;
-            flags.push_back(fm_event_flag::Created);
-            events.emplace_back(path, curr_time, flags);
+            top_nodes.insert(node);
+        }
+
+        /* The crawler lists the new directory after this callback returns. */
+        if (S_ISDIR(fd_stat.st_mode)) {
+            tracked_directory &directory = directories[node];
+            tracked_paths.get_path(node, directory.path);
+            directory.listed_ns = get_time_ns(curr_time);
+
+            /* A new directory is likely to change again soon. */
+            directory.polls = poll_count;
+            directory.interval_ns = min_interval_ns;
+            directory.changed_ns = get_steady_time_ns();
+            directory.due_ns = directory.changed_ns + min_interval_ns;
         }
 
         return true;
     }
 
-    bool Poll_monitor::add_path(const std::string &path, const struct stat &fd_stat,
+    bool Poll_monitor::add_path(Path_tree::node_id node, const struct stat &fd_stat,
                                 poll_monitor_scan_callback poll_callback) {
-        return (this->*(poll_callback))(path, fd_stat);
+        return (this->*(poll_callback))(node, fd_stat);
     }
 
-    void Poll_monitor::scan(const std::string &path,
-                            poll_monitor_scan_callback fn) {
-        struct stat fd_stat;
-        if (!lstat_path(path, fd_stat))
-            return;
+    unsigned long long Poll_monitor::scan(const std::vector<std::string> &roots,
+                                          poll_monitor_scan_callback fn,
+                                          Directory_crawler &crawler) {
+        /* Filtered entries are pruned before they are stat'ed. */
+        crawler.set_filter([this] (const std::string &entry_path, bool is_dir) {
+            return accept_path(entry_path, is_dir);
+        });
+        crawler.set_stat_queue_depth(stat_queue_depth);
+        crawler.set_stat_batches(crawler_batches);
 
-        if (follow_symlinks && S_ISLNK(fd_stat.st_mode)) {
-            string link_path;
-            if (read_link_path(path, link_path))
-                scan(link_path, fn);
-        }
+        return crawler.crawl(roots, [this, fn] (const std::string &node_path,
+                                               const struct stat &fd_stat,
+                                               bool) {
+            bool is_dir = S_ISDIR(fd_stat.st_mode);
+
+            if (!accept_path(node_path, is_dir)) return false;
+
+            bool added;
 
-        if (!accept_path(path)) return;
-        if (!add_path(path, fd_stat, fn)) return;
-        if (!recursive) return;
-        if (!S_ISDIR(fd_stat.st_mode)) return;
+            {
+                std::lock_guard<std::mutex> scan_guard(scan_mutex);
 
-        vector<string> children = get_directory_children(path);
-        for (const string &child : children) {
-            if (child == "." || child == "..") continue;
+                /* Hold a reference on the node while it is being added. */
+                Path_tree::node_id node = tracked_paths.acquire(node_path);
+                added = add_path(node, fd_stat, fn);
+                tracked_paths.release(node);
+            }
+
+            if (added && recursive && is_dir) load_ignore_file(node_path);
+
+            return added && recursive;
+        });
+    }
 
-            scan(path + "/" + child, fn);
+    void Poll_monitor::sweep() {
+        for (size_t node = 0; node < tracked_entries.size(); ++node) {
+            tracked_entry &entry = tracked_entries[node];
+            if (entry.generation == 0 || entry.generation == generation) continue;
+
+            entry.generation = 0;
+            --tracked_count;
+            removed_nodes.push_back(static_cast<Path_tree::node_id>(node));
         }
     }
 
-    void Poll_monitor::find_removed_files() {
-        vector<fm_event_flag> flags;
-        flags.push_back(fm_event_flag::Removed);
+    bool Poll_monitor::is_same_file(const tracked_entry &removed, const tracked_entry &created) {
+        if (removed.is_dir != created.is_dir) return false;
+
+        /*
+         * A new file or directory may reuse the inode of a removed one, and is
+         * then told apart by its modification time: a move only updates the
+         * change time of the object moved.  A directory whose entries changed
+         * within the poll it was moved in is reported as removed and created,
+         * and its entries as moved.
+         */
+        if (removed.mtime_ns != created.mtime_ns) return false;
+
+        /* The size of a directory depends on the entries it once held. */
+        if (created.is_dir) return removed.link_count == created.link_count;
+
+        return removed.size == created.size;
+    }
+
+    const Poll_monitor::tracked_entry &Poll_monitor::get_removed_entry(Path_tree::node_id node) const {
+        auto replaced = replaced_entries.find(node);
+
+        return replaced != replaced_entries.end() ? replaced->second : tracked_entries[node];
+    }
+
+    void Poll_monitor::report_changes(bool sort_events) {
+        if (detect_moves && !created_nodes.empty() && !removed_nodes.empty()) {
+            for (Path_tree::node_id node : removed_nodes) {
+                const tracked_entry &entry = get_removed_entry(node);
+                removed_inodes.emplace(inode_key{entry.device, entry.inode}, node);
+            }
+
+            for (Path_tree::node_id node : created_nodes) {
+                const tracked_entry &entry = tracked_entries[node];
+                auto removed = removed_inodes.find(inode_key{entry.device, entry.inode});
+
+                /* A node untracked and tracked again by the same poll kept its path. */
+                if (removed == removed_inodes.end() || removed->second == node) continue;
+                if (!is_same_file(get_removed_entry(removed->second), entry)) continue;
 
-        for (auto &removed : previous_data->tracked_files) {
-            events.emplace_back(removed.first, curr_time, flags);
+                moved_nodes.emplace(node, removed->second);
+                moved_from.insert(removed->second);
+                removed_inodes.erase(removed);
+            }
+        }
+
+        for (Path_tree::node_id node : removed_nodes) {
+            if (!moved_from.count(node)) add_event(node, fm_event_flag::Removed);
         }
+
+        for (Path_tree::node_id node : created_nodes) {
+            auto moved = moved_nodes.find(node);
+
+            if (moved == moved_nodes.end()) {
+                add_event(node, fm_event_flag::Created);
+                continue;
+            }
+
+            /*
+             * Parents are created before their children: an entry that kept
+             * its name in a moved directory has been moved with it.
+             */
+            auto parent = moved_nodes.find(tracked_paths.get_parent(node));
+
+            if (parent != moved_nodes.end() && parent->second == tracked_paths.get_parent(moved->second)) {
+                size_t length, previous_length;
+                const char *name = tracked_paths.get_name(node, length);
+                const char *previous_name = tracked_paths.get_name(moved->second, previous_length);
+
+                if (length == previous_length && std::equal(name, name + length, previous_name)) continue;
+            }
+
+            moves.emplace_back();
+            tracked_paths.get_path(moved->second, moves.back().from);
+            tracked_paths.get_path(node, moves.back().to);
+        }
+
+        if (sort_events) events.sort_by_path();
+
+        /* Moves follow the other events so that each pair stays together. */
+        std::sort(moves.begin(), moves.end(), [] (const poll_move &a, const poll_move &b) {
+            return a.to < b.to;
+        });
+
+        for (const poll_move &move : moves) {
+            events.add(move.from, curr_time, fm_event_flag::Removed | fm_event_flag::MovedFrom | fm_event_flag::Renamed);
+            events.add(move.to, curr_time, fm_event_flag::Created | fm_event_flag::MovedTo | fm_event_flag::Renamed);
+        }
+
+        set_statistic("poll.moved_entries", moves.size());
+
+        for (Path_tree::node_id node : removed_nodes) tracked_paths.release(node);
+
+        created_nodes.clear();
+        removed_nodes.clear();
+        replaced_entries.clear();
+        removed_inodes.clear();
+        moved_nodes.clear();
+        moved_from.clear();
+        moves.clear();
     }
 
-    void Poll_monitor::swap_data_containers() {
-        delete  previous_data;
-        previous_data = new_data;
-        new_data = new POLL_MONITOR_DATA();
+    void Poll_monitor::publish_statistics() {
+        set_statistic("poll.tracked_files", tracked_count);
+        set_statistic("poll.tracking_table_bytes", tracked_entries.capacity() * sizeof(tracked_entry));
+        set_statistic("poll.path_tree_nodes", tracked_paths.size());
+        set_statistic("poll.path_tree_bytes", tracked_paths.memory_usage());
     }
 
     void Poll_monitor::collect_data() {
         poll_monitor_scan_callback fn = &Poll_monitor::intermediate_scan_callback;
 
-        for (string &path : paths) {
-            scan(path, fn);
+        /* Generation 0 marks the entries that are not tracked. */
+        if (++generation == 0) generation = 1;
+
+        /*
+         * The roots and the directories below them are spread across the
+         * crawler threads, which stat their entries concurrently.  With a
+         * single thread, events are collected in scan order; otherwise the
+         * order in which the threads find changes depends on scheduling, and
+         * the events of the cycle are sorted by path so that it does not.
+         */
+        Directory_crawler crawler(poll_threads, follow_symlinks, &should_stop);
+
+        auto scan_start = std::chrono::steady_clock::now();
+        unsigned long long visited = scan(paths, fn, crawler);
+
+        /*
+         * A scan interrupted by stop() is incomplete: the files it did not
+         * reach are kept as they were instead of being reported as removed.
+         */
+        if (should_stop) {
+            listing_interrupted = true;
+            report_changes(crawler.get_thread_count() > 1);
+            return;
         }
 
-        find_removed_files();
-        swap_data_containers();
+        sweep();
+        listing_interrupted = false;
+
+        report_changes(crawler.get_thread_count() > 1);
+
+        publish_statistics();
+        set_statistic("poll.stat_calls", visited);
+        set_statistic("poll.scan_time_ms", std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - scan_start).count());
+    }
+
+    void Poll_monitor::index_directories(long long listed_ns) {
+        directories.clear();
+        top_nodes.clear();
+
+        /* Directories that must be listed again are due immediately. */
+        const long long due_ns = listed_ns ? get_steady_time_ns() + initial_interval_ns : 0;
+
+        for (size_t node = 0; node < tracked_entries.size(); ++node) {
+            if (!tracked_entries[node].generation || !tracked_entries[node].is_dir) continue;
+
+            tracked_directory &directory = directories[static_cast<Path_tree::node_id>(node)];
+            tracked_paths.get_path(static_cast<Path_tree::node_id>(node), directory.path);
+            directory.listed_ns = listed_ns;
+            directory.polls = poll_count;
+            directory.interval_ns = initial_interval_ns;
+            directory.due_ns = due_ns;
+            directory.changed_ns = 0;
+        }
+
+        for (size_t node = 0; node < tracked_entries.size(); ++node) {
+            if (!tracked_entries[node].generation) continue;
+
+            auto parent = directories.find(tracked_paths.get_parent(static_cast<Path_tree::node_id>(node)));
+
+            if (parent != directories.end()) {
+                parent->second.children.push_back(static_cast<Path_tree::node_id>(node));
+            } else {
+                top_nodes.insert(static_cast<Path_tree::node_id>(node));
+            }
+        }
+    }
+
+    void Poll_monitor::probe_groups(size_t first_group, size_t step) {
+        /*
+         * The paths are gathered in a buffer, NUL-separated, and stat'ed by
+         * chunks so that the requests of a chunk can be submitted together.
+         */
+        static const size_t PROBE_CHUNK_SIZE = 1024;
+
+        Stat_batch *stats = stat_batches[first_group].get();
+        string paths;
+        vector<size_t> offsets;
+        vector<size_t> chunk;
+        struct stat fd_stat;
+        unsigned long long calls = 0;
+
+        auto stat_chunk = [&] () {
+            stats->clear();
+            for (size_t offset : offsets) stats->add(AT_FDCWD, paths.data() + offset);
+            stats->run();
+
+            for (size_t k = 0; k < chunk.size(); ++k) {
+                poll_probe &probe = probes[chunk[k]];
+
+                probe.found = stats->get_result(k, fd_stat);
+                if (probe.found) set_state(probe.state, fd_stat);
+            }
+
+            calls += chunk.size();
+            paths.clear();
+            offsets.clear();
+            chunk.clear();
+        };
+
+        for (size_t g = first_group; g < groups.size(); g += step) {
+            const probe_group &group = groups[g];
+
+            for (size_t i = group.first; i < group.first + group.count; ++i) {
+                offsets.push_back(paths.size());
+                paths.append(*group.path);
+
+                /* The files of a directory follow it. */
+                if (group.is_directory && i != group.first) {
+                    size_t length;
+                    const char *name = tracked_paths.get_name(probes[i].node, length);
+
+                    paths.append(1, '/').append(name, length);
+                }
+
+                paths.append(1, '\0');
+                chunk.push_back(i);
+
+                if (chunk.size() == PROBE_CHUNK_SIZE) stat_chunk();
+            }
+        }
+
+        if (!chunk.empty()) stat_chunk();
+
+        stat_calls += calls;
+    }
+
+    void Poll_monitor::untrack_tree(Path_tree::node_id node, bool replaced) {
+        auto directory = directories.find(node);
+
+        if (directory != directories.end()) {
+            vector<Path_tree::node_id> children;
+            children.swap(directory->second.children);
+            directories.erase(directory);
+
+            for (Path_tree::node_id child : children) untrack_tree(child, replaced);
+        }
+
+        top_nodes.erase(node);
+        if (replaced) replaced_entries.emplace(node, tracked_entries[node]);
+
+        tracked_entries[node].generation = 0;
+        --tracked_count;
+        removed_nodes.push_back(node);
+    }
+
+    void Poll_monitor::replace_entry(Path_tree::node_id node) {
+        string path;
+        tracked_paths.get_path(node, path);
+
+        auto parent = directories.find(tracked_paths.get_parent(node));
+
+        if (parent != directories.end()) {
+            vector<Path_tree::node_id> &siblings = parent->second.children;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), node), siblings.end());
+        }
+
+        untrack_tree(node, true);
+
+        Directory_crawler crawler(1, follow_symlinks, &should_stop);
+        stat_calls += scan({path}, &Poll_monitor::incremental_scan_callback, crawler);
+    }
+
+    void Poll_monitor::list_directory(Path_tree::node_id node) {
+        tracked_directory &directory = directories[node];
+        Directory_reader reader;
+
+        if (!reader.open(directory.path)) return;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        directory.listed_ns = get_time_ns(now);
+
+        vector<Path_tree::node_id> children;
+        children.swap(directory.children);
+
+        listed_children.clear();
+        new_entries.clear();
+
+        DIRECTORY_ENTRY entry;
+
+        while (reader.next(entry)) {
+            Path_tree::node_id child = tracked_paths.find_child(node, entry.name, entry.name_length);
+
+            if (child != Path_tree::npos && is_tracked(child)) {
+                directory.children.push_back(child);
+                listed_children.insert(child);
+                continue;
+            }
+
+            new_entries.emplace_back(directory.path);
+            new_entries.back().append(1, '/').append(entry.name, entry.name_length);
+        }
+
+        reader.close();
+
+        for (Path_tree::node_id child : children) {
+            if (!listed_children.count(child)) untrack_tree(child);
+        }
+
+        if (new_entries.empty()) return;
+
+        /*
+         * New entries are crawled like new roots: the entries they contain
+         * are reported as created and tracked.
+         */
+        Directory_crawler crawler(1, follow_symlinks, &should_stop);
+        stat_calls += scan(new_entries, &Poll_monitor::incremental_scan_callback, crawler);
+    }
+
+    void Poll_monitor::schedule_directory(Path_tree::node_id node, bool changed, long long now_ns) {
+        auto directory = directories.find(node);
+
+        /* The directory has been removed by the poll. */
+        if (directory == directories.end()) return;
+
+        ++directory->second.polls;
+
+        if (!adaptive) return;
+
+        tracked_directory &scheduled = directory->second;
+
+        if (changed) {
+            scheduled.interval_ns = min_interval_ns;
+            scheduled.changed_ns = now_ns;
+        } else {
+            scheduled.interval_ns = std::min(scheduled.interval_ns * 2, max_interval_ns);
+        }
+
+        scheduled.due_ns = now_ns + scheduled.interval_ns;
+    }
+
+    void Poll_monitor::collect_incremental_data() {
+        auto scan_start = std::chrono::steady_clock::now();
+
+        stat_calls = 0;
+        unsigned long long listed_directories = 0;
+
+        /* Roots that did not exist yet are crawled as new entries. */
+        new_entries.clear();
+
+        for (const string &path : paths) {
+            Path_tree::node_id node = tracked_paths.find(path);
+            if (node == Path_tree::npos || !is_tracked(node)) new_entries.push_back(path);
+        }
+
+        if (!new_entries.empty()) {
+            Directory_crawler crawler(1, follow_symlinks, &should_stop);
+            stat_calls += scan(new_entries, &Poll_monitor::incremental_scan_callback, crawler);
+        }
+
+        const long long now_ns = get_steady_time_ns();
+        unsigned long long deferred_directories = 0;
+
+        /*
+         * Every tracked directory is stat'ed, or in the adaptive mode those
+         * that are due, followed by its files if they are due at this poll of
+         * the directory: the files of a directory are stat'ed once every
+         * file_stat_interval polls, at a poll depending on the directory so
+         * that the load is spread across the polls.
+         */
+        due_directories.clear();
+
+        for (auto &tracked : directories) {
+            const tracked_directory &directory = tracked.second;
+            if (directory.due_ns > now_ns) continue;
+
+            due_directories.push_back({now_ns - directory.due_ns > max_interval_ns,
+                                       directory.changed_ns,
+                                       directory.due_ns,
+                                       tracked.first});
+        }
+
+        if (adaptive && io_budget) {
+            std::sort(due_directories.begin(), due_directories.end());
+
+            const double elapsed = last_poll_ns ? (now_ns - last_poll_ns) / 1e9 : 1.0;
+            io_credit = std::min(static_cast<double>(io_budget), io_credit + io_budget * elapsed);
+            last_poll_ns = now_ns;
+        }
+
+        probes.clear();
+        groups.clear();
+        top_file_paths.clear();
+        top_file_paths.reserve(top_nodes.size());
+
+        /* Set when the rest of the budget is saved for an overdue directory. */
+        bool saving_budget = false;
+
+        for (auto &due : due_directories) {
+            if (saving_budget) {
+                ++deferred_directories;
+                continue;
+            }
+
+            const Path_tree::node_id node = due.node;
+            tracked_directory &directory = directories[node];
+            const bool files_due = recursive && file_stat_interval &&
+                                   (directory.polls + node) % file_stat_interval == 0;
+
+            groups.push_back({&directory.path, probes.size(), 1, true});
+            probes.push_back({node, false, tracked_entry()});
+
+            if (files_due) {
+                for (Path_tree::node_id child : directory.children) {
+                    if (tracked_entries[child].is_dir) continue;
+
+                    probes.push_back({child, false, tracked_entry()});
+                    ++groups.back().count;
+                }
+            }
+
+            if (!adaptive || !io_budget) continue;
+
+            /*
+             * A directory that does not fit the remaining budget waits for a
+             * later poll.  One costing more than the whole budget is polled
+             * when the bucket is full, so that it is not starved.  If an
+             * overdue directory does not fit, no other directory is polled
+             * until it does: the bucket then refills for it.
+             */
+            const bool fits = probes.size() <= io_credit;
+            const bool starving = groups.size() == 1 && io_credit >= io_budget;
+
+            if (!fits && !starving) {
+                probes.resize(groups.back().first);
+                groups.pop_back();
+                ++deferred_directories;
+
+                saving_budget = due.overdue;
+            }
+        }
+
+        for (Path_tree::node_id node : top_nodes) {
+            if (tracked_entries[node].is_dir) continue;
+
+            top_file_paths.emplace_back();
+            tracked_paths.get_path(node, top_file_paths.back());
+
+            groups.push_back({&top_file_paths.back(), probes.size(), 1, false});
+            probes.push_back({node, false, tracked_entry()});
+        }
+
+        if (poll_threads == 1) {
+            probe_groups(0, 1);
+        } else {
+            vector<std::thread> threads;
+
+            for (unsigned int i = 1; i < poll_threads; ++i) {
+                threads.emplace_back(&Poll_monitor::probe_groups, this, i, poll_threads);
+            }
+
+            probe_groups(0, poll_threads);
+
+            for (std::thread &thread : threads) thread.join();
+        }
+
+        /*
+         * Changes are applied on this thread.  Nodes untracked in the
+         * meantime are skipped: they are only released at the end of the
+         * poll, so that their identifiers are not reused by new entries.
+         */
+        for (const probe_group &group : groups) {
+            if (should_stop) break;
+
+            const size_t event_count = events.size();
+            const size_t created_count = created_nodes.size();
+            const size_t removed_count = removed_nodes.size();
+            bool listed = false;
+
+            for (size_t i = group.first; i < group.first + group.count; ++i) {
+                const poll_probe &probe = probes[i];
+
+                if (!is_tracked(probe.node)) continue;
+
+                if (!probe.found) {
+                    /* Other nodes are removed when their directory is listed. */
+                    if (top_nodes.count(probe.node)) untrack_tree(probe.node);
+                    continue;
+                }
+
+                tracked_entry &entry = tracked_entries[probe.node];
+                const bool was_dir = entry.is_dir;
+
+                /*
+                 * An entry replaced by another object is reported as removed
+                 * and created: a new directory is then tracked and crawled,
+                 * and the entries of a former one are removed.
+                 */
+                if (is_replaced(entry, probe.state)) {
+                    replace_entry(probe.node);
+                    continue;
+                }
+
+                fm_event_mask flags = get_changes(entry, probe.state);
+                const bool listing_changed = probe.state.mtime_ns != entry.mtime_ns;
+
+                const uint32_t entry_generation = entry.generation;
+                entry = probe.state;
+                entry.generation = entry_generation;
+
+                if (flags != NoOp) add_event(probe.node, flags);
+
+                if (!was_dir || !recursive) continue;
+
+                const bool racy = entry.mtime_ns + RACY_INTERVAL_NS > directories[probe.node].listed_ns;
+
+                if (listing_changed || racy) {
+                    list_directory(probe.node);
+                    ++listed_directories;
+                    listed = true;
+                }
+            }
+
+            if (group.is_directory) {
+                schedule_directory(probes[group.first].node,
+                                   listed ||
+                                   events.size() != event_count ||
+                                   created_nodes.size() != created_count ||
+                                   removed_nodes.size() != removed_count,
+                                   now_ns);
+            }
+        }
+
+        /* Listings and the entries they found are charged to the budget. */
+        if (adaptive && io_budget) io_credit -= stat_calls + listed_directories;
+
+        /* Directories may have been left partially crawled. */
+        listing_interrupted = should_stop;
+
+        ++poll_count;
+
+        /* Changes are found in hash table order: sort them. */
+        report_changes(true);
+
+        publish_statistics();
+        set_statistic("poll.stat_calls", stat_calls);
+        set_statistic("poll.listed_directories", listed_directories);
+
+        if (adaptive) {
+            set_statistic("poll.polled_directories", groups.size() - top_file_paths.size());
+            set_statistic("poll.deferred_directories", deferred_directories);
+        }
+
+        set_statistic("poll.scan_time_ms", std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - scan_start).count());
     }
 
     void Poll_monitor::collect_initial_data() {
         poll_monitor_scan_callback fn = &Poll_monitor::initial_scan_callback;
 
+        Directory_crawler crawler(static_cast<unsigned int>(get_numeric_property("scan.threads", 1)),
+                                  follow_symlinks,
+                                  &should_stop);
+
         for (string &path : paths) {
-            scan(path, fn);
+            auto scan_start = std::chrono::steady_clock::now();
+            unsigned long long visited = scan({path}, fn, crawler);
+            auto scan_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - scan_start);
+
+            set_statistic("scan.time_ms:" + path, scan_time.count());
+            set_statistic("scan.nodes:" + path, visited);
         }
+
+        publish_statistics();
+    }
+
+    void Poll_monitor::configure() {
+        const long long thread_count = get_numeric_property("poll.threads", 1);
+
+        if (thread_count < 0) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.threads: %lld",
+                                                                thread_count),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        poll_threads = thread_count ? static_cast<unsigned int>(thread_count)
+                                    : std::max(1u, std::thread::hardware_concurrency());
+
+        const std::string mode = get_property("poll.mode");
+
+        if (!mode.empty() && mode != "full" && mode != "incremental" && mode != "adaptive") {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.mode: %s",
+                                                                mode.c_str()),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        adaptive = (mode == "adaptive");
+        incremental = (mode == "incremental" || adaptive);
+
+        const long long min_interval_ms = get_numeric_property("poll.min_interval_ms", 250);
+
+        if (min_interval_ms <= 0) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.min_interval_ms: %lld",
+                                                                min_interval_ms),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        const long long max_interval_ms = get_numeric_property("poll.max_interval_ms", 60000);
+
+        if (max_interval_ms < min_interval_ms) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.max_interval_ms: %lld",
+                                                                max_interval_ms),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        io_budget = get_numeric_property("poll.io_budget", 0);
+
+        if (io_budget < 0) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.io_budget: %lld",
+                                                                io_budget),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        const long long latency_ms = static_cast<long long>(
+                (latency < MIN_POLL_LATENCY ? MIN_POLL_LATENCY : latency) * 1000);
+
+        /* The adaptive mode checks which directories are due every minimum interval. */
+        poll_interval_ms = adaptive ? min_interval_ms : latency_ms;
+
+        if (adaptive) {
+            min_interval_ns = min_interval_ms * 1000000LL;
+            max_interval_ns = max_interval_ms * 1000000LL;
+            initial_interval_ns = std::min(std::max(latency_ms, min_interval_ms), max_interval_ms) * 1000000LL;
+        }
+
+        const long long interval = get_numeric_property("poll.file_stat_interval", 1);
+
+        if (interval < 0) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.file_stat_interval: %lld",
+                                                                interval),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        file_stat_interval = static_cast<unsigned int>(interval);
+
+        const long long moves = get_numeric_property("poll.detect_moves", 1);
+
+        if (moves != 0 && moves != 1) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property poll.detect_moves: %lld",
+                                                                moves),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        detect_moves = (moves == 1);
     }
 
     void Poll_monitor::run() {
+        stat_batches.clear();
+        crawler_batches.clear();
+
+        for (unsigned int i = 0; i < poll_threads; ++i) {
+            stat_batches.push_back(Stat_batch::create(stat_queue_depth));
+            crawler_batches.push_back(stat_batches.back().get());
+        }
+
+        struct timespec scan_start;
+        clock_gettime(CLOCK_REALTIME, &scan_start);
+
         collect_initial_data();
+        if (should_stop) listing_interrupted = true;
+
+        /*
+         * If a scan was interrupted, the tracked directories may lack some of
+         * their entries: they are all listed again at the first poll.
+         */
+        if (incremental) index_directories(listing_interrupted ? 0 : get_time_ns(scan_start));
+
+        const std::chrono::milliseconds poll_interval(poll_interval_ms);
 
         for (;;) {
-            unique_lock<mutex> run_guard(run_mutex);
             if (should_stop) break;
-            run_guard.unlock();
 
-            sleep(latency < MIN_POLL_LATENCY ? MIN_POLL_LATENCY : latency);
-            time(&curr_time);
-            collect_data();
+            if (wait_for_stop(poll_interval)) break;
+            clock_gettime(CLOCK_REALTIME, &curr_time);
+
+            if (incremental) {
+                collect_incremental_data();
+            } else {
+                collect_data();
+            }
 
             if (!events.empty()) {
                 notify_events(events);
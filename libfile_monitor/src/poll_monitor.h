@@ -6,9 +6,20 @@
 #define FILE_MONITOR_POLL_MONITOR_H
 
 #include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <string>
 #include <sys/stat.h>
 #include <ctime>
+#include <cstdint>
 #include "monitor.h"
+#include <mutex>
+#include <atomic>
+#include "path_tree.h"
+#include "crawler.h"
+#include "stat_batch.h"
 
 namespace fm {
     class Poll_monitor : public Monitor {
@@ -19,8 +30,15 @@ namespace fm {
         virtual ~Poll_monitor();
 
     protected:
+        void configure();
         void run();
 
+        /*
+         * Number of stat() requests each thread submits at a time through
+         * io_uring, 0 for synchronous calls.
+         * */
+        unsigned int stat_queue_depth = 0;
+
     private:
         static const unsigned int MIN_POLL_LATENCY = 1;
 
@@ -28,37 +46,290 @@ namespace fm {
         Poll_monitor &operator=(const Poll_monitor &orig) = delete;
 
         typedef bool (Poll_monitor::*poll_monitor_scan_callback)(
-                const std::string &path,
+                Path_tree::node_id node,
                 const struct stat &stat);
 
-        typedef struct _watched_file_info {
-            time_t mtime;
-            time_t ctime;
-        }WATCHED_FILE_INFO;
+        /*
+         * State of a tracked node, indexed by its identifier in
+         * Poll_monitor::tracked_paths.  Each tracked entry holds a reference
+         * on its node.
+         * */
+        struct tracked_entry {
+            uint32_t generation;            // last poll that saw the node, 0 if it is not tracked
+            bool is_dir;
+            uint16_t link_count;            // saturated at UINT16_MAX
+            dev_t device;
+            ino_t inode;
+            long long size;
+            long long mtime_ns;
+            long long ctime_ns;
+        };
+
+        /*
+         * Identity of a file across renames.
+         * */
+        struct inode_key {
+            dev_t device;
+            ino_t inode;
+
+            bool operator==(const inode_key &other) const {
+                return device == other.device && inode == other.inode;
+            }
+        };
+
+        struct inode_key_hash {
+            size_t operator()(const inode_key &key) const {
+                return std::hash<unsigned long long>()(static_cast<unsigned long long>(key.inode) * 31 +
+                                                       static_cast<unsigned long long>(key.device));
+            }
+        };
+
+        /*
+         * A tracked entry that reappeared under another path.
+         * */
+        struct poll_move {
+            std::string from;
+            std::string to;
+        };
+
+        /*
+         * Directory tracked by the incremental mode: its tracked entries, when
+         * it was last listed, how many times it has been polled and, in the
+         * adaptive mode, its poll interval, the time it is due and the last
+         * time it changed, 0 if it has not.
+         * */
+        struct tracked_directory {
+            std::string path;
+            std::vector<Path_tree::node_id> children;
+            long long listed_ns;
+            unsigned long long polls;
+            long long interval_ns;
+            long long due_ns;
+            long long changed_ns;
+        };
+
+        /*
+         * Directory due in the adaptive mode.  When the budget does not cover
+         * every due directory, those overdue by more than the maximum interval
+         * are polled first, so that idle directories are not starved by busy
+         * ones, then those that changed most recently, and then those due for
+         * the longest time.
+         * */
+        struct due_directory {
+            bool overdue;
+            long long changed_ns;
+            long long due_ns;
+            Path_tree::node_id node;
 
-        typedef struct _poll_monitor_data {
-            std::unordered_map<std::string, WATCHED_FILE_INFO> tracked_files;
-        }POLL_MONITOR_DATA;
+            bool operator<(const due_directory &other) const {
+                if (overdue != other.overdue) return overdue;
+                if (overdue) return due_ns != other.due_ns ? due_ns < other.due_ns : node < other.node;
+                if (changed_ns != other.changed_ns) return changed_ns > other.changed_ns;
+                if (due_ns != other.due_ns) return due_ns < other.due_ns;
+                return node < other.node;
+            }
+        };
 
-        void scan(const std::string &path, poll_monitor_scan_callback fn);
+        /*
+         * Result of the stat() of a tracked node during an incremental poll.
+         * */
+        struct poll_probe {
+            Path_tree::node_id node;
+            bool found;
+            tracked_entry state;
+        };
+
+        /*
+         * Nodes stat'ed together: a directory followed by the files it
+         * contains that are due, or a tracked file outside any tracked
+         * directory.
+         * */
+        struct probe_group {
+            const std::string *path;
+            size_t first;
+            size_t count;
+            bool is_directory;
+        };
+
+        /*
+         * Scans @p roots with @p crawler, invoking @p fn for each accepted node.
+         * It returns the number of nodes visited by the crawler.
+         * */
+        unsigned long long scan(const std::vector<std::string> &roots,
+                                poll_monitor_scan_callback fn,
+                                Directory_crawler &crawler);
         void collect_initial_data();
         void collect_data();
-        bool add_path(const std::string &path,
+        bool add_path(Path_tree::node_id node,
                       const struct stat &fd_stat,
                       poll_monitor_scan_callback poll_callback);
-        bool initial_scan_callback(const std::string &path,
+        bool initial_scan_callback(Path_tree::node_id node,
                                   const struct stat &fd_stat);
-        bool intermediate_scan_callback(const std::string &path,
+        bool intermediate_scan_callback(Path_tree::node_id node,
                                         const struct stat &fd_stat);
+        void add_event(Path_tree::node_id node, fm_event_mask flags);
+
+        static void set_state(tracked_entry &entry, const struct stat &fd_stat);
+
+        /*
+         * Returns the changes between two states of a node.
+         * */
+        static fm_event_mask get_changes(const tracked_entry &previous, const tracked_entry &current);
+
+        /*
+         * Returns true if the object found at the path of a node is not the
+         * one it tracked: it has another type or another inode, for example
+         * because a file was moved over it.
+         * */
+        static bool is_replaced(const tracked_entry &previous, const tracked_entry &current);
+
+        /*
+         * Returns the entry of @p node, growing the table if needed.
+         * */
+        tracked_entry &get_entry(Path_tree::node_id node);
+        bool is_tracked(Path_tree::node_id node) const;
+
+        /*
+         * Starts tracking @p node with the state of @p fd_stat.
+         * */
+        void track(Path_tree::node_id node, const struct stat &fd_stat);
+
+        /*
+         * Stops tracking the entries that the last poll did not see.
+         * */
+        void sweep();
+
+        /*
+         * Reports the entries created and removed during the poll.  A removed
+         * entry whose inode reappears in a created entry has been moved: the
+         * pair is reported as a MovedFrom event immediately followed by a
+         * MovedTo event, after the other events of the poll, which are sorted
+         * first if @p sort_events is true.  The entries below a moved
+         * directory are not reported if they kept their names.
+         * */
+        void report_changes(bool sort_events);
+        static bool is_same_file(const tracked_entry &removed, const tracked_entry &created);
+
+        /*
+         * Returns the state of @p node before it was removed by the poll.
+         * */
+        const tracked_entry &get_removed_entry(Path_tree::node_id node) const;
+        void publish_statistics();
+
+        /*
+         * Incremental mode: every poll stats the tracked directories, lists
+         * again those whose modification time changed and stats the files of
+         * the directories that are due.
+         * */
+        void collect_incremental_data();
+        bool incremental_scan_callback(Path_tree::node_id node,
+                                       const struct stat &fd_stat);
+
+        /*
+         * Rebuilds the directory index of the incremental mode from the
+         * tracked files.
+         * */
+        void index_directories(long long listed_ns);
+        void probe_groups(size_t first_group, size_t step);
+        void list_directory(Path_tree::node_id node);
+
+        /*
+         * Schedules the next poll of the directory @p node.  In the adaptive
+         * mode, a directory is polled again after the minimum interval when it
+         * has changed, and its interval doubles up to the maximum otherwise.
+         * */
+        void schedule_directory(Path_tree::node_id node, bool changed, long long now_ns);
+
+        /*
+         * Stops tracking @p node and the nodes below it.  If @p replaced is
+         * set, their state is kept until the poll is reported, since the crawl
+         * of the replacing object may track them again.
+         * */
+        void untrack_tree(Path_tree::node_id node, bool replaced = false);
+
+        /*
+         * Stops tracking @p node, which has been replaced by another object,
+         * and crawls it again as a new entry.
+         * */
+        void replace_entry(Path_tree::node_id node);
+
+        /*
+         * Serializes the updates performed by the crawler threads.
+         * */
+        std::mutex scan_mutex;
+        Path_tree tracked_paths;
+
+        /*
+         * Entries are marked with the generation of the poll that sees them,
+         * and those left with an older generation once the tree has been
+         * crawled have been removed.  The table is updated in place, so that
+         * a poll does not allocate once it has grown to the size of the tree.
+         * */
+        std::vector<tracked_entry> tracked_entries;
+        uint32_t generation = 1;
+        size_t tracked_count = 0;
+        std::string event_path;
+
+        /*
+         * Entries created and removed during the poll.  Removed nodes are
+         * released once the poll has been reported, so that node identifiers
+         * are not reused by the poll.
+         * */
+        std::vector<Path_tree::node_id> created_nodes;
+        std::vector<Path_tree::node_id> removed_nodes;
+        std::unordered_map<Path_tree::node_id, tracked_entry> replaced_entries;   // removed and tracked again
+        bool detect_moves = true;
+        std::unordered_map<inode_key, Path_tree::node_id, inode_key_hash> removed_inodes;
+        std::unordered_map<Path_tree::node_id, Path_tree::node_id> moved_nodes;    // new node -> old node
+        std::unordered_set<Path_tree::node_id> moved_from;
+        std::vector<poll_move> moves;
+        std::string move_path;
+
+        Event_batch events;
+        struct timespec curr_time;
+
+        /* Number of threads stat'ing the tree at each poll. */
+        unsigned int poll_threads = 1;
+
+        /*
+         * Stat batch of each poll thread, and its io_uring instance, reused
+         * across the polls and the crawls of the monitor.
+         * */
+        std::vector<std::unique_ptr<Stat_batch>> stat_batches;
+        std::vector<Stat_batch *> crawler_batches;
 
-        void find_removed_files();
-        void swap_data_containers();
+        long long poll_interval_ms = 0;                         // time between two wakeups
 
-        POLL_MONITOR_DATA *previous_data;
-        POLL_MONITOR_DATA *new_data;
+        /*
+         * State of the incremental mode.
+         * */
+        bool incremental = false;
+        unsigned int file_stat_interval = 1;                    // polls between two stat() of a file
+        unsigned long long poll_count = 0;
+        bool listing_interrupted = false;                       // every directory must be listed again
+        std::unordered_map<Path_tree::node_id, tracked_directory> directories;
+        std::unordered_set<Path_tree::node_id> top_nodes;       // tracked nodes outside tracked directories
+        std::vector<poll_probe> probes;
+        std::vector<probe_group> groups;
+        std::vector<std::string> top_file_paths;
+        std::unordered_set<Path_tree::node_id> listed_children;
+        std::vector<std::string> new_entries;
+        std::atomic<unsigned long long> stat_calls{0};
 
-        std::vector<Event> events;
-        time_t curr_time;
+        /*
+         * State of the adaptive mode.  The monitor wakes up every minimum
+         * interval and polls the directories that are due within the I/O
+         * budget: a token bucket refilled with io_budget stat() calls per
+         * second and holding at most one second of budget.
+         * */
+        bool adaptive = false;
+        long long min_interval_ns = 0;
+        long long max_interval_ns = 0;
+        long long initial_interval_ns = 0;
+        long long io_budget = 0;                                // stat() calls per second, 0 if unlimited
+        double io_credit = 0;
+        long long last_poll_ns = 0;
+        std::vector<due_directory> due_directories;
     };
 }
 
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "config.h"
+#if defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+#include "stat_batch.h"
+
+namespace fm {
+    /*
+     * Performs each request with an fstatat() call.
+     * */
+    class Sync_stat_batch : public Stat_batch {
+    public:
+        void run() override {
+            for (stat_request &request : requests) run_sync(request);
+        }
+
+        bool is_asynchronous() const override { return false; }
+    };
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+    /*
+     * Submits statx requests to an io_uring instance set up with raw system
+     * calls.  Each round fills the submission queue, submits it and waits for
+     * all its completions with a single io_uring_enter() call, which is only
+     * repeated if it is interrupted.
+     * */
+    class Uring_stat_batch : public Stat_batch {
+    public:
+        explicit Uring_stat_batch(unsigned int queue_depth);
+        ~Uring_stat_batch() override;
+
+        bool is_usable() const { return ring_fd >= 0 && !failed; }
+        void run() override;
+        bool is_asynchronous() const override { return !failed; }
+
+    private:
+        void run_round(size_t first, size_t count);
+
+        int ring_fd = -1;
+        unsigned int depth = 0;
+
+        /*
+         * Set when io_uring_enter() fails.  The ring is no longer entered,
+         * since it may still hold submissions, and the requests are performed
+         * synchronously.
+         * */
+        bool failed = false;
+
+        void *sq_ring = MAP_FAILED;
+        void *cq_ring = MAP_FAILED;
+        size_t sq_ring_size = 0;
+        size_t cq_ring_size = 0;
+        struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+        size_t sqes_size = 0;
+
+        unsigned *sq_tail = nullptr;
+        unsigned *sq_mask = nullptr;
+        unsigned *sq_array = nullptr;
+        unsigned *cq_head = nullptr;
+        unsigned *cq_tail = nullptr;
+        unsigned *cq_mask = nullptr;
+        struct io_uring_cqe *cqes = nullptr;
+
+        std::vector<struct statx> results;
+        std::vector<char> done;                 // completed requests of the current round
+    };
+
+    Uring_stat_batch::Uring_stat_batch(unsigned int queue_depth) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, queue_depth, &params));
+        if (ring_fd < 0) return;
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+        /* Since Linux 5.4 both rings share a single mapping. */
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            if (cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+            cq_ring_size = sq_ring_size;
+        }
+
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQ_RING);
+
+        if (sq_ring != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP)) {
+            cq_ring = sq_ring;
+        } else if (sq_ring != MAP_FAILED) {
+            cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring_fd, IORING_OFF_CQ_RING);
+        }
+
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        if (cq_ring != MAP_FAILED) {
+            sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        }
+
+        if (sqes == MAP_FAILED) {
+            if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+            if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+            sq_ring = cq_ring = MAP_FAILED;
+
+            ::close(ring_fd);
+            ring_fd = -1;
+            return;
+        }
+
+        char *sq = static_cast<char *>(sq_ring);
+        char *cq = static_cast<char *>(cq_ring);
+
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        depth = params.sq_entries;
+        results.resize(depth);
+        done.resize(depth);
+    }
+
+    Uring_stat_batch::~Uring_stat_batch() {
+        if (ring_fd < 0) return;
+
+        munmap(sqes, sqes_size);
+        if (cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        ::close(ring_fd);
+    }
+
+    static void statx_to_stat(const struct statx &source, struct stat &target) {
+        memset(&target, 0, sizeof(target));
+
+        target.st_dev = makedev(source.stx_dev_major, source.stx_dev_minor);
+        target.st_ino = source.stx_ino;
+        target.st_mode = source.stx_mode;
+        target.st_nlink = source.stx_nlink;
+        target.st_uid = source.stx_uid;
+        target.st_gid = source.stx_gid;
+        target.st_rdev = makedev(source.stx_rdev_major, source.stx_rdev_minor);
+        target.st_size = static_cast<off_t>(source.stx_size);
+        target.st_blksize = source.stx_blksize;
+        target.st_blocks = static_cast<blkcnt_t>(source.stx_blocks);
+        target.st_atim.tv_sec = source.stx_atime.tv_sec;
+        target.st_atim.tv_nsec = source.stx_atime.tv_nsec;
+        target.st_mtim.tv_sec = source.stx_mtime.tv_sec;
+        target.st_mtim.tv_nsec = source.stx_mtime.tv_nsec;
+        target.st_ctim.tv_sec = source.stx_ctime.tv_sec;
+        target.st_ctim.tv_nsec = source.stx_ctime.tv_nsec;
+    }
+
+    void Uring_stat_batch::run() {
+        for (size_t first = 0; first < requests.size(); first += depth) {
+            run_round(first, std::min(static_cast<size_t>(depth), requests.size() - first));
+        }
+    }
+
+    void Uring_stat_batch::run_round(size_t first, size_t count) {
+        if (failed) {
+            for (size_t i = 0; i < count; ++i) run_sync(requests[first + i]);
+            return;
+        }
+
+        /* Only this thread produces submissions: the tail is not shared. */
+        unsigned tail = *sq_tail;
+
+        for (size_t i = 0; i < count; ++i) {
+            const stat_request &request = requests[first + i];
+            const unsigned index = tail & *sq_mask;
+            struct io_uring_sqe &sqe = sqes[index];
+
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = request.dir_fd;
+            sqe.addr = reinterpret_cast<uintptr_t>(request.path);
+            sqe.len = STATX_BASIC_STATS;
+            sqe.off = reinterpret_cast<uintptr_t>(&results[i]);
+            sqe.statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe.user_data = i;
+
+            sq_array[index] = index;
+            done[i] = false;
+            ++tail;
+        }
+
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+        size_t to_submit = count;
+        size_t completed = 0;
+
+        while (completed < count) {
+            const long submitted = syscall(__NR_io_uring_enter, ring_fd, to_submit, count - completed,
+                                           IORING_ENTER_GETEVENTS, nullptr, 0);
+
+            /*
+             * The requests that did not complete are performed synchronously,
+             * and so are those of the following rounds.
+             */
+            if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                perror("io_uring_enter");
+                failed = true;
+
+                for (size_t i = 0; i < count; ++i) {
+                    if (!done[i]) run_sync(requests[first + i]);
+                }
+
+                return;
+            }
+
+            if (submitted > 0) to_submit -= static_cast<size_t>(submitted);
+
+            unsigned head = *cq_head;
+            const unsigned available = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != available; ++head, ++completed) {
+                const struct io_uring_cqe &cqe = cqes[head & *cq_mask];
+                stat_request &request = requests[first + cqe.user_data];
+
+                request.found = (cqe.res == 0);
+                if (request.found) statx_to_stat(results[cqe.user_data], request.fd_stat);
+                done[cqe.user_data] = true;
+            }
+
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    /*
+     * IORING_OP_STATX is supported since Linux 5.6: older kernels, and those
+     * where io_uring is disabled, fail the setup or the probe.
+     * */
+    static bool probe_uring() {
+        Uring_stat_batch batch(1);
+        if (!batch.is_usable()) return false;
+
+        batch.add(AT_FDCWD, "/");
+        batch.run();
+
+        struct stat fd_stat;
+        return batch.is_usable() && batch.get_result(0, fd_stat) && S_ISDIR(fd_stat.st_mode);
+    }
+
+    bool Stat_batch::is_uring_available() {
+        static const bool available = probe_uring();
+        return available;
+    }
+
+    std::unique_ptr<Stat_batch> Stat_batch::create(unsigned int queue_depth) {
+        if (queue_depth && is_uring_available()) {
+            std::unique_ptr<Uring_stat_batch> batch(new Uring_stat_batch(queue_depth));
+            if (batch->is_usable()) return std::unique_ptr<Stat_batch>(batch.release());
+        }
+
+        return std::unique_ptr<Stat_batch>(new Sync_stat_batch());
+    }
+#else
+    bool Stat_batch::is_uring_available() {
+        return false;
+    }
+
+    std::unique_ptr<Stat_batch> Stat_batch::create(unsigned int) {
+        return std::unique_ptr<Stat_batch>(new Sync_stat_batch());
+    }
+#endif
+
+    void Stat_batch::run_sync(stat_request &request) {
+        request.found = fstatat(request.dir_fd, request.path, &request.fd_stat, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+
+    size_t Stat_batch::add(int dir_fd, const char *path) {
+        requests.push_back({dir_fd, path, false, {}});
+        return requests.size() - 1;
+    }
+
+    bool Stat_batch::get_result(size_t index, struct stat &fd_stat) const {
+        const stat_request &request = requests[index];
+        if (request.found) fd_stat = request.fd_stat;
+
+        return request.found;
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * @brief Header of the fm::Stat_batch class.
+ *
+ * This header file defines the fm::Stat_batch class, a batch of lstat()
+ * requests performed either synchronously or through io_uring.
+ * */
+
+#ifndef FILE_MONITOR_STAT_BATCH_H
+#define FILE_MONITOR_STAT_BATCH_H
+
+#include <vector>
+#include <memory>
+#include <sys/stat.h>
+
+namespace fm {
+    /*
+     * @brief Batch of lstat() requests.
+     *
+     * Requests are queued with add() and performed together by run(), after
+     * which their results can be read.  The synchronous batch performs one
+     * fstatat() call per request; the io_uring batch submits statx requests
+     * in rounds of up to its queue depth, with a single system call per round.
+     * If the ring fails, an io_uring batch performs the requests left and the
+     * following ones synchronously.
+     *
+     * A batch is used by a single thread and reused across runs.
+     * */
+    class Stat_batch {
+    public:
+        virtual ~Stat_batch() = default;
+
+        /*
+         * Creates a batch submitting up to @p queue_depth requests at a time
+         * through io_uring, or a synchronous batch if @p queue_depth is 0 or
+         * the kernel does not support statx requests.
+         * */
+        static std::unique_ptr<Stat_batch> create(unsigned int queue_depth);
+
+        /*
+         * Returns true if io_uring batches can be created.  The check is
+         * performed once.
+         * */
+        static bool is_uring_available();
+
+        /*
+         * Queues the lstat() of @p path relative to the directory descriptor
+         * @p dir_fd, or to the working directory if it is AT_FDCWD.  @p path
+         * must stay valid until run() returns.  Returns the index of the
+         * request.
+         * */
+        size_t add(int dir_fd, const char *path);
+
+        /*
+         * Performs the queued requests.
+         * */
+        virtual void run() = 0;
+
+        virtual bool is_asynchronous() const = 0;
+
+        /*
+         * Returns false if the request @p index failed, otherwise stores its
+         * result in @p fd_stat.
+         * */
+        bool get_result(size_t index, struct stat &fd_stat) const;
+        size_t size() const { return requests.size(); }
+        void clear() { requests.clear(); }
+
+    protected:
+        struct stat_request {
+            int dir_fd;
+            const char *path;
+            bool found;
+            struct stat fd_stat;
+        };
+
+        /*
+         * Performs @p request with an fstatat() call.
+         * */
+        static void run_sync(stat_request &request);
+
+        std::vector<stat_request> requests;
+    };
+}
+
+#endif //FILE_MONITOR_STAT_BATCH_H
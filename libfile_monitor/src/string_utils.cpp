@@ -1,5 +1,6 @@
 #include <cstdarg>
 #include <cstdio>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include "string_utils.h"
@@ -37,5 +38,16 @@ namespace fm {
             va_end(args);
             return ret;
         }
+
+        size_t hash(const char *data, size_t length) {
+            uint64_t hash = 14695981039346656037ull;
+
+            for (size_t i = 0; i < length; ++i) {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 1099511628211ull;
+            }
+
+            return static_cast<size_t>(hash ^ (hash >> 32));
+        }
     }
 }
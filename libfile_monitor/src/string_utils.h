@@ -4,11 +4,17 @@
 
 #include <cstdarg>
 #include <string>
+#include <cstddef>
 
 namespace fm {
     namespace string_utils {
         std::string string_from_format(const char* format, ...);
         std::string vstring_from_format(const char* format, va_list args);
+
+        /*
+         * Returns the FNV-1a hash of the @p length bytes of @p data.
+         * */
+        size_t hash(const char *data, size_t length);
     }
 }
 
@@ -0,0 +1,89 @@
+#include <memory>
+#include <cstdint>
+#include "subscription_set.h"
+
+namespace fm {
+    /* Bits of the per-event state of a subscription. */
+    static const uint8_t PATH_INCLUDED = 1 << 0;
+    static const uint8_t PATH_EXCLUDED = 1 << 1;
+
+    Subscription_set::Subscription_set(std::vector<subscription> subscriptions) :
+            subscriptions(std::move(subscriptions)), compiled(this->subscriptions.size()) {
+        for (unsigned int s = 0; s < this->subscriptions.size(); ++s) {
+            const subscription &current = this->subscriptions[s];
+            compiled_subscription &target = compiled[s];
+
+            for (const Monitor_filter &filter : current.filters) {
+                if (filter.glob) {
+                    target.ignore_rules.add_rule("", filter.text, filter.case_sensitive,
+                                                 filter.type == fm_filter_type::filter_include);
+                    continue;
+                }
+
+                filters.add(filter);
+                filter_owners.push_back(s);
+            }
+
+            if (current.event_types.empty()) continue;
+
+            target.accepted_event_types = NoOp;
+            target.accept_no_op = false;
+
+            for (const EVENT_TYPE_FILTER &event_type : current.event_types) {
+                if (event_type.flag == NoOp) target.accept_no_op = true;
+                target.accepted_event_types |= event_type.flag;
+            }
+        }
+    }
+
+    void Subscription_set::deliver(const Event_batch &batch) const {
+        /* Scratch storage, reused by the thread across batches. */
+        static thread_local std::vector<std::unique_ptr<Event_batch>> batches;
+        static thread_local std::vector<uint8_t> states;
+        static thread_local std::vector<unsigned int> matched;
+
+        while (batches.size() < subscriptions.size()) batches.emplace_back(new Event_batch);
+        for (size_t s = 0; s < subscriptions.size(); ++s) batches[s]->clear();
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const char *path = batch.get_path(i);
+            const size_t length = batch.get_path_length(i);
+            const fm_event_mask flags = batch.get_mask(i);
+
+            states.assign(subscriptions.size(), 0);
+
+            /* Idle events have no path to filter. */
+            if (flags != NoOp) {
+                matched.clear();
+                filters.match_all(path, length, matched);
+
+                for (unsigned int filter : matched) {
+                    states[filter_owners[filter]] |=
+                            (filters.get_type(filter) == fm_filter_type::filter_include) ? PATH_INCLUDED : PATH_EXCLUDED;
+                }
+            }
+
+            for (size_t s = 0; s < subscriptions.size(); ++s) {
+                const compiled_subscription &target = compiled[s];
+                fm_event_mask accepted;
+
+                if (flags == NoOp) {
+                    if (!target.accept_no_op) continue;
+                    accepted = NoOp;
+                } else {
+                    accepted = flags & target.accepted_event_types;
+
+                    if (accepted == NoOp) continue;
+                    if ((states[s] & PATH_EXCLUDED) && !(states[s] & PATH_INCLUDED)) continue;
+                    if (target.ignore_rules.is_ignored(path, length, (flags & IsDir) != 0)) continue;
+                }
+
+                batches[s]->add(path, length, batch.get_time_ns(i), accepted);
+            }
+        }
+
+        for (size_t s = 0; s < subscriptions.size(); ++s) {
+            if (!batches[s]->empty()) subscriptions[s].deliver(*batches[s]);
+        }
+    }
+}
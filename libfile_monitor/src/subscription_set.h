@@ -0,0 +1,79 @@
+/*
+ * @brief Header of the fm::Subscription_set class.
+ *
+ * This header file defines the fm::Subscription_set class, the subscriptions
+ * sharing the events of a monitor.
+ * */
+
+#ifndef FILE_MONITOR_SUBSCRIPTION_SET_H
+#define FILE_MONITOR_SUBSCRIPTION_SET_H
+
+#include <vector>
+#include <functional>
+#include "event.h"
+#include "event_batch.h"
+#include "filter.h"
+#include "path_filter.h"
+#include "glob_filter.h"
+
+namespace fm {
+    typedef unsigned int fm_subscription_id;
+
+    /*
+     * @brief Immutable set of subscriptions, each with its own filters.
+     *
+     * The path filters of all the subscriptions are compiled into a single
+     * fm::Path_filter, so that the path of an event is scanned once for all
+     * the subscriptions; each filter then counts towards the subscription it
+     * belongs to.  A subscription accepts the paths that match one of its
+     * inclusion filters or none of its exclusion filters and that none of its
+     * glob filters ignores, and the events whose type passes its event type
+     * filters.
+     *
+     * A set is never modified once built: a monitor replaces it when
+     * subscriptions change, so that it can be used without locking while it
+     * delivers events.
+     * */
+    class Subscription_set {
+    public:
+        typedef std::function<void(const Event_batch &)> delivery_function;
+
+        struct subscription {
+            fm_subscription_id id;
+            std::vector<Monitor_filter> filters;
+            std::vector<EVENT_TYPE_FILTER> event_types;
+            delivery_function deliver;
+        };
+
+        /*
+         * Compiles the filters of @p subscriptions.  std::regex_error is thrown
+         * if a regular expression is not valid.
+         * */
+        explicit Subscription_set(std::vector<subscription> subscriptions);
+        Subscription_set(const Subscription_set &orig) = delete;
+        Subscription_set &operator=(const Subscription_set &that) = delete;
+
+        const std::vector<subscription> &get_subscriptions() const { return subscriptions; }
+        size_t size() const { return subscriptions.size(); }
+
+        /*
+         * Delivers to each subscription the events of @p batch it accepts, with
+         * the flags its event type filters accept.
+         * */
+        void deliver(const Event_batch &batch) const;
+
+    private:
+        struct compiled_subscription {
+            fm_event_mask accepted_event_types = ~NoOp;
+            bool accept_no_op = true;
+            Glob_filter ignore_rules;
+        };
+
+        std::vector<subscription> subscriptions;
+        std::vector<compiled_subscription> compiled;
+        Path_filter filters;                        // the path filters of all the subscriptions
+        std::vector<unsigned int> filter_owners;    // subscription of each filter
+    };
+}
+
+#endif //FILE_MONITOR_SUBSCRIPTION_SET_H
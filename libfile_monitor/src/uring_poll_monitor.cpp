@@ -0,0 +1,30 @@
+#include "uring_poll_monitor.h"
+#include "stat_batch.h"
+#include "exception.h"
+#include "string_utils.h"
+
+namespace fm {
+    Uring_poll_monitor::Uring_poll_monitor(std::vector<std::string> paths,
+                                           FM_EVENT_CALLBACK *callback,
+                                           void *context) :
+        Poll_monitor(std::move(paths), callback, context)
+    {
+    }
+
+    void Uring_poll_monitor::configure() {
+        const long long queue_depth = get_numeric_property("uring.queue_depth", DEFAULT_QUEUE_DEPTH);
+
+        if (queue_depth <= 0 || queue_depth > MAX_QUEUE_DEPTH) {
+            throw fm_exception(string_utils::string_from_format("Invalid value for property uring.queue_depth: %lld",
+                                                                queue_depth),
+                               FM_ERR_INVALID_PROPERTY);
+        }
+
+        const bool enabled = Stat_batch::is_uring_available();
+
+        stat_queue_depth = enabled ? static_cast<unsigned int>(queue_depth) : 0;
+        set_statistic("uring.enabled", enabled ? 1 : 0);
+
+        Poll_monitor::configure();
+    }
+}
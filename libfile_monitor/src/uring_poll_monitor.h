@@ -0,0 +1,42 @@
+/**
+ *  `statx` based monitor submitting its requests through io_uring.
+ */
+
+#ifndef FILE_MONITOR_URING_POLL_MONITOR_H
+#define FILE_MONITOR_URING_POLL_MONITOR_H
+
+#include <string>
+#include <vector>
+#include "poll_monitor.h"
+
+namespace fm {
+    /*
+     * @brief Poll monitor stat'ing the tree through io_uring.
+     *
+     * The monitor behaves as fm::Poll_monitor, with the same properties, but
+     * each thread submits its stat() requests as statx requests to its own
+     * io_uring instance, up to the uring.queue_depth property at a time.
+     * Directory listings remain synchronous.  If the kernel does not support
+     * io_uring statx requests, or the library was built without them, the
+     * synchronous calls of fm::Poll_monitor are used and the uring.enabled
+     * statistic is 0.
+     * */
+    class Uring_poll_monitor : public Poll_monitor {
+    public:
+        Uring_poll_monitor(std::vector<std::string> paths,
+                           FM_EVENT_CALLBACK *callback,
+                           void *context = nullptr);
+
+    protected:
+        void configure();
+
+    private:
+        static const unsigned int DEFAULT_QUEUE_DEPTH = 256;
+        static const unsigned int MAX_QUEUE_DEPTH = 32768;
+
+        Uring_poll_monitor(const Uring_poll_monitor &orig) = delete;
+        Uring_poll_monitor &operator=(const Uring_poll_monitor &orig) = delete;
+    };
+}
+
+#endif //FILE_MONITOR_URING_POLL_MONITOR_H
@@ -0,0 +1,83 @@
+#include "watch_table.h"
+
+namespace fm {
+    Watch_table::Watch_table(Path_tree &tree) : tree(tree) {
+    }
+
+    Watch_table::~Watch_table() {
+        for_each([this] (int wd) { tree.release(nodes_by_wd[wd]); });
+    }
+
+    void Watch_table::insert(int wd, const std::string &path) {
+        if (wd < 0) return;
+
+        Path_tree::node_id node = tree.acquire(path);
+
+        erase(wd);
+
+        int previous = find_wd(node);
+        if (previous != -1) erase(previous);
+
+        if (static_cast<size_t>(wd) >= nodes_by_wd.size()) {
+            nodes_by_wd.resize(wd + 1, Path_tree::npos);
+        }
+        if (node >= wds_by_node.size()) {
+            wds_by_node.resize(tree.capacity(), -1);
+        }
+
+        nodes_by_wd[wd] = node;
+        wds_by_node[node] = wd;
+        ++watch_count;
+    }
+
+    bool Watch_table::erase(int wd) {
+        if (!contains(wd)) return false;
+
+        Path_tree::node_id node = nodes_by_wd[wd];
+        nodes_by_wd[wd] = Path_tree::npos;
+        wds_by_node[node] = -1;
+        --watch_count;
+
+        tree.release(node);
+
+        return true;
+    }
+
+    bool Watch_table::contains(int wd) const {
+        return wd >= 0 &&
+               static_cast<size_t>(wd) < nodes_by_wd.size() &&
+               nodes_by_wd[wd] != Path_tree::npos;
+    }
+
+    Path_tree::node_id Watch_table::find_node(int wd) const {
+        return contains(wd) ? nodes_by_wd[wd] : Path_tree::npos;
+    }
+
+    bool Watch_table::get_path(int wd, std::string &path) const {
+        if (!contains(wd)) return false;
+
+        tree.get_path(nodes_by_wd[wd], path);
+        return true;
+    }
+
+    int Watch_table::find_wd(Path_tree::node_id node) const {
+        return node < wds_by_node.size() ? wds_by_node[node] : -1;
+    }
+
+    int Watch_table::find_wd(const std::string &path) const {
+        return find_wd(tree.find(path));
+    }
+
+    size_t Watch_table::size() const {
+        return watch_count;
+    }
+
+    bool Watch_table::empty() const {
+        return watch_count == 0;
+    }
+
+    size_t Watch_table::memory_usage() const {
+        return nodes_by_wd.capacity() * sizeof(Path_tree::node_id) +
+               wds_by_node.capacity() * sizeof(int);
+    }
+}
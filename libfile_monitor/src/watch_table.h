@@ -0,0 +1,94 @@
+/*
+ * @brief Header of the fm::Watch_table class.
+ *
+ * This header file defines the fm::Watch_table class, the table of the
+ * watches registered by the inotify monitor.
+ * */
+
+#ifndef FILE_MONITOR_WATCH_TABLE_H
+#define FILE_MONITOR_WATCH_TABLE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "path_tree.h"
+
+namespace fm {
+    /*
+     * @brief Table mapping watch descriptors to paths and back.
+     *
+     * The kernel allocates watch descriptors as small, increasing integers,
+     * hence watches are stored in a vector indexed by descriptor.  Watched
+     * paths are interned in a Path_tree, and the reverse mapping is a vector
+     * indexed by node identifier, so that no path string is stored and lookups
+     * do not copy strings.
+     *
+     * Unknown descriptors are never inserted by a lookup.
+     * */
+    class Watch_table {
+    public:
+        explicit Watch_table(Path_tree &tree);
+        ~Watch_table();
+        Watch_table(const Watch_table &orig) = delete;
+        Watch_table &operator=(const Watch_table &that) = delete;
+
+        /*
+         * Adds or replaces the watch @p wd.  If @p path was watched by another
+         * descriptor, that watch is replaced.
+         * */
+        void insert(int wd, const std::string &path);
+
+        /*
+         * Removes the watch @p wd.  Returns false if @p wd is unknown.
+         * */
+        bool erase(int wd);
+
+        bool contains(int wd) const;
+
+        /*
+         * Returns the node watched by @p wd, or Path_tree::npos if @p wd is
+         * unknown.
+         * */
+        Path_tree::node_id find_node(int wd) const;
+
+        /*
+         * Materializes the path watched by @p wd into @p path.  Returns false
+         * if @p wd is unknown.
+         * */
+        bool get_path(int wd, std::string &path) const;
+
+        /*
+         * Returns the descriptor watching @p path, or -1 if @p path is not
+         * watched.
+         * */
+        int find_wd(const std::string &path) const;
+        int find_wd(Path_tree::node_id node) const;
+
+        size_t size() const;
+        bool empty() const;
+
+        /*
+         * Returns the number of bytes allocated by the table, excluding the
+         * path tree.
+         * */
+        size_t memory_usage() const;
+
+        /*
+         * Invokes @p fn with each watch descriptor in the table.
+         * */
+        template <typename Function>
+        void for_each(Function fn) const {
+            for (size_t wd = 0; wd < nodes_by_wd.size(); ++wd) {
+                if (nodes_by_wd[wd] != Path_tree::npos) fn(static_cast<int>(wd));
+            }
+        }
+
+    private:
+        Path_tree &tree;
+        std::vector<Path_tree::node_id> nodes_by_wd;   // indexed by watch descriptor
+        std::vector<int> wds_by_node;                  // indexed by node identifier
+        size_t watch_count = 0;
+    };
+}
+
+#endif //FILE_MONITOR_WATCH_TABLE_H